@@ -35,6 +35,19 @@ class Controller {
                        const DeviceInfo &device_info) = 0;
   virtual Status ChipErase(const DeviceInfo &device_info) = 0;
   virtual Status SectionErase(Section section, const DeviceInfo &device_info) = 0;
+  // Erases the flash row starting at address. Rows are row_erase_size bytes.
+  virtual Status RowErase(uint32_t, const DeviceInfo &) {
+    return Status(UNIMPLEMENTED, "Row erase not implemented for this device family");
+  }
+  // Writes data like Write, but reads back each unit directly after programming it. Returns
+  // VERIFICATION_ERROR if the data read back differs, or UNIMPLEMENTED without writing anything if
+  // the family can't verify this way.
+  virtual Status WriteVerified(Section, uint32_t, const Datastring &, const DeviceInfo &) {
+    return Status(UNIMPLEMENTED, "Verified writes not implemented for this device family");
+  }
+  // Returns an estimate of the number of commands needed to move from the current position to
+  // address in section. Used to order operations such that seeking is minimized.
+  virtual uint32_t SeekCost(Section, uint32_t, const DeviceInfo &) const { return 0; }
 };
 
 #endif
@@ -81,6 +81,7 @@ static void MultiplyUnits(DeviceInfo *info, uint32_t unit_factor, uint32_t addre
   info->eeprom_size *= unit_factor;
   info->eeprom_address *= address_factor;
   info->write_block_size *= unit_factor;
+  info->row_erase_size *= unit_factor;
   std::vector<uint32_t> missing_locations;
   for (uint32_t location : info->missing_locations) {
     for (uint32_t i = 0; i < address_factor; ++i) {
@@ -171,6 +172,9 @@ Status DeviceDb::Load(const std::string &name) {
       } else if (key == "write_block_size") {
         RETURN_IF_ERROR_WITH_APPEND(NumericalValue(value, &last_info.write_block_size),
                                     strings::Cat(" in device database at line ", i + 1));
+      } else if (key == "row_erase_size") {
+        RETURN_IF_ERROR_WITH_APPEND(NumericalValue(value, &last_info.row_erase_size),
+                                    strings::Cat(" in device database at line ", i + 1));
       } else if (key == "block_write_sequence") {
         RETURN_IF_ERROR_WITH_APPEND(
             SequenceValue(value, &last_info.block_write_sequence, sequence_validator_),
@@ -203,6 +207,10 @@ Status DeviceDb::Load(const std::string &name) {
         RETURN_IF_ERROR_WITH_APPEND(
             SequenceValue(value, &last_info.eeprom_erase_sequence, sequence_validator_),
             strings::Cat(" in device database at line ", i + 1));
+      } else if (key == "row_erase_sequence") {
+        RETURN_IF_ERROR_WITH_APPEND(
+            SequenceValue(value, &last_info.row_erase_sequence, sequence_validator_),
+            strings::Cat(" in device database at line ", i + 1));
       } else if (key == "bulk_erase_timing") {
         RETURN_IF_ERROR_WITH_APPEND(DurationValue(value, &last_info.bulk_erase_timing),
                                     strings::Cat(" in device database at line ", i + 1));
@@ -212,6 +220,9 @@ Status DeviceDb::Load(const std::string &name) {
       } else if (key == "config_write_timing") {
         RETURN_IF_ERROR_WITH_APPEND(DurationValue(value, &last_info.config_write_timing),
                                     strings::Cat(" in device database at line ", i + 1));
+      } else if (key == "row_erase_timing") {
+        RETURN_IF_ERROR_WITH_APPEND(DurationValue(value, &last_info.row_erase_timing),
+                                    strings::Cat(" in device database at line ", i + 1));
       } else if (key == "missing_locations") {
         std::vector<std::string> sequence = strings::Split<std::string>(value, ' ', false);
         for (const auto &single_value : sequence) {
@@ -246,7 +257,7 @@ Status DeviceDb::Load(const std::string &name) {
   return Status::OK;
 }
 
-Status DeviceDb::GetDeviceInfo(uint16_t device_id, DeviceInfo *device_info) {
+Status DeviceDb::GetDeviceInfo(uint16_t device_id, DeviceInfo *device_info) const {
   if (device_db_.find(device_id) == device_db_.end()) {
     return Status(DEVICE_NOT_FOUND,
                   strings::Cat("Device with ID ", HexUint16(device_id), " not found"));
@@ -255,7 +266,7 @@ Status DeviceDb::GetDeviceInfo(uint16_t device_id, DeviceInfo *device_info) {
   return Status::OK;
 }
 
-Status DeviceDb::GetDeviceInfo(const std::string &device_name, DeviceInfo *device_info) {
+Status DeviceDb::GetDeviceInfo(const std::string &device_name, DeviceInfo *device_info) const {
   for (const auto &device_registration : device_db_) {
     if (device_registration.second.name == device_name) {
       *device_info = device_registration.second;
@@ -285,14 +296,17 @@ void DeviceInfo::Dump() const {
   printf("EEPROM size: %d\n", eeprom_size);
   printf("EEPROM offset: %06Xh\n", eeprom_address);
   printf("Write block size: %d\n", write_block_size);
+  printf("Row erase size: %d\n", row_erase_size);
   DumpSequence("Chip erase sequence:", chip_erase_sequence);
   DumpSequence("Flash erase sequence:", flash_erase_sequence);
   DumpSequence("User ID erase sequence:", user_id_erase_sequence);
   DumpSequence("Config erase sequence:", config_erase_sequence);
   DumpSequence("EEPROM erase sequence:", eeprom_erase_sequence);
+  DumpSequence("Row erase sequence:", row_erase_sequence);
   printf("Bulk erase timing: %lldns\n", (long long)bulk_erase_timing.count());
   printf("Block write timing: %lldns\n", (long long)block_write_timing.count());
   printf("Config write timing: %lldns\n", (long long)config_write_timing.count());
+  printf("Row erase timing: %lldns\n", (long long)row_erase_timing.count());
   printf("Missing locations:");
   for (const auto &location : missing_locations) {
     printf("%06Xh", location);
@@ -304,6 +318,10 @@ Status DeviceInfo::Validate() const {
   if (program_memory_size == 0) {
     return Status(PARSE_ERROR, strings::Cat(name, ": Program memory must be larger than 0"));
   }
+  if (row_erase_size > 0 && (write_block_size == 0 || row_erase_size % write_block_size != 0)) {
+    return Status(PARSE_ERROR,
+                  strings::Cat(name, ": Row erase size must be a multiple of write block size"));
+  }
 
   IntervalSet<uint32_t> used_intervals;
   used_intervals.Add(Interval<uint32_t>(0, program_memory_size));
@@ -31,6 +31,8 @@ struct DeviceInfo {
   uint32_t eeprom_size = 0;
   uint32_t eeprom_address = 0;
   uint16_t write_block_size = 0;
+  // Size of the flash rows erased by Controller::RowErase. Zero if row erase is not supported.
+  uint16_t row_erase_size = 0;
   Datastring16 block_write_sequence;
   Datastring16 config_write_sequence;
   Datastring16 eeprom_write_sequence;
@@ -39,9 +41,11 @@ struct DeviceInfo {
   Datastring16 user_id_erase_sequence;
   Datastring16 config_erase_sequence;
   Datastring16 eeprom_erase_sequence;
+  Datastring16 row_erase_sequence;
   Duration bulk_erase_timing = ZeroDuration;
   Duration block_write_timing = MilliSeconds(1);
   Duration config_write_timing = MilliSeconds(5);
+  Duration row_erase_timing = MilliSeconds(5);
   std::vector<uint32_t> missing_locations;
   uint32_t calibration_word_size = 0;
   uint32_t calibration_word_address = 0;
@@ -63,8 +67,8 @@ class DeviceDb {
         sequence_validator_(sequence_validator) {}
   Status Load(const std::string &name);
 
-  Status GetDeviceInfo(uint16_t device_id, DeviceInfo *device_info);
-  Status GetDeviceInfo(const std::string &device_name, DeviceInfo *device_info);
+  Status GetDeviceInfo(uint16_t device_id, DeviceInfo *device_info) const;
+  Status GetDeviceInfo(const std::string &device_name, DeviceInfo *device_info) const;
   uint32_t GetBlockSizeMultiple() const { return unit_factor_; }
   const Datastring &GetBlockFillter() const { return block_filler_; }
 
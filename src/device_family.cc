@@ -0,0 +1,95 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "device_family.h"
+
+#include "pic16controller.h"
+#include "pic18controller.h"
+#include "pic24controller.h"
+#include "picnew8bitcontroller.h"
+#include "sequence_generator.h"
+#include "strings.h"
+#include "util.h"
+
+Status CreateController(const std::string &family, std::unique_ptr<Driver> driver,
+                        std::unique_ptr<Controller> *controller) {
+  if (family == "pic18") {
+    std::unique_ptr<Pic18SequenceGenerator> sequence_generator(new Pic18SequenceGenerator);
+    controller->reset(new Pic18Controller(std::move(driver), std::move(sequence_generator)));
+  } else if (family == "pic18-new") {
+    std::unique_ptr<PicNew8BitSequenceGenerator> sequence_generator(
+        new PicNew8BitSequenceGenerator);
+    controller->reset(new PicNew8BitController(std::move(driver), std::move(sequence_generator),
+                                               PicNew8BitController::PIC18NEW));
+  } else if (family == "pic10" || family == "pic12" || family == "pic16") {
+    std::unique_ptr<Pic16SequenceGenerator> sequence_generator(new Pic16SequenceGenerator);
+    controller->reset(
+        new Pic16MidrangeController(std::move(driver), std::move(sequence_generator)));
+  } else if (family == "pic10-small" || family == "pic12-small" || family == "pic16-small") {
+    std::unique_ptr<Pic16SequenceGenerator> sequence_generator(new Pic16SequenceGenerator);
+    controller->reset(
+        new Pic16BaselineController(std::move(driver), std::move(sequence_generator)));
+  } else if (family == "pic16-new") {
+    std::unique_ptr<PicNew8BitSequenceGenerator> sequence_generator(
+        new PicNew8BitSequenceGenerator);
+    controller->reset(new PicNew8BitController(std::move(driver), std::move(sequence_generator),
+                                               PicNew8BitController::PIC16NEW));
+  } else if (family == "pic24") {
+    std::unique_ptr<Pic24SequenceGenerator> sequence_generator(new Pic24SequenceGenerator);
+    controller->reset(new Pic24Controller(std::move(driver), std::move(sequence_generator)));
+  } else {
+    return Status(INVALID_ARGUMENT, strings::Cat("Unknown device family ", family));
+  }
+  return Status::OK;
+}
+
+Status CreateDeviceDb(const std::string &family, std::unique_ptr<DeviceDb> *device_db) {
+  if (family == "pic18" || family == "pic18-new") {
+    *device_db = std::make_unique<DeviceDb>(1, 1, Datastring{0xff},
+                                            [](const Datastring16 &) { return Status::OK; });
+  } else if (family == "pic10" || family == "pic12" || family == "pic16" ||
+             family == "pic16-new") {
+    *device_db =
+        std::make_unique<DeviceDb>(2, 2, Datastring{0xff, 0x3f}, [](const Datastring16 &sequence) {
+          return Pic16SequenceGenerator::ValidateSequence(sequence);
+        });
+  } else if (family == "pic10-small" || family == "pic12-small" || family == "pic16-small") {
+    *device_db =
+        std::make_unique<DeviceDb>(2, 2, Datastring{0xff, 0x0f}, [](const Datastring16 &sequence) {
+          return Pic16SequenceGenerator::ValidateSequence(sequence);
+        });
+  } else if (family == "pic24") {
+    *device_db = std::make_unique<DeviceDb>(4, 2, Datastring{0xff, 0xff, 0xff, 0x00},
+                                            [](const Datastring16 &) { return Status::OK; });
+  } else {
+    return Status(INVALID_ARGUMENT, strings::Cat("Unknown device family ", family));
+  }
+  return Status::OK;
+}
+
+// Returns the path of the device DB for family, used when no file is specified.
+#if defined(DEVICE_DB_PATH)
+static std::string DefaultDeviceDbPath(const std::string &family, const std::string &) {
+  return strings::Cat(DEVICE_DB_PATH, "/", family, ".lst");
+}
+#else
+static std::string DefaultDeviceDbPath(const std::string &family, const std::string &binary_path) {
+  return strings::Cat(Dirname(binary_path), "/device_db/", family, ".lst");
+}
+#endif
+
+Status LoadDeviceDb(const std::string &family, const std::string &filename,
+                    const std::string &binary_path, std::unique_ptr<DeviceDb> *device_db) {
+  RETURN_IF_ERROR(CreateDeviceDb(family, device_db));
+  return (*device_db)->Load(filename.empty() ? DefaultDeviceDbPath(family, binary_path) : filename);
+}
@@ -0,0 +1,39 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DEVICE_FAMILY_H_
+#define DEVICE_FAMILY_H_
+
+#include <memory>
+#include <string>
+
+#include "controller.h"
+#include "device_db.h"
+#include "driver.h"
+#include "status.h"
+
+// Creates the controller for the device family named family, which uses driver to communicate
+// with the device.
+Status CreateController(const std::string &family, std::unique_ptr<Driver> driver,
+                        std::unique_ptr<Controller> *controller);
+
+// Creates an empty DeviceDb with the parameters for the device family named family.
+Status CreateDeviceDb(const std::string &family, std::unique_ptr<DeviceDb> *device_db);
+
+// Creates the DeviceDb for the device family named family, and loads it from filename. If filename
+// is empty, the default device DB for the family is loaded, using binary_path to locate it if no
+// DEVICE_DB_PATH was configured.
+Status LoadDeviceDb(const std::string &family, const std::string &filename,
+                    const std::string &binary_path, std::unique_ptr<DeviceDb> *device_db);
+
+#endif
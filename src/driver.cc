@@ -16,19 +16,36 @@
 #include <cstring>
 #include <gflags/gflags.h>
 
+#include "ftdi_common.h"
+#include "ftdi_mpsse.h"
 #include "ftdi_sb.h"
+#include "ftdi_usb.h"
+#include "strings.h"
 
-DEFINE_string(driver, "FtdiSb", "Driver to use for programming. One of FtdiSb");
+DEFINE_string(driver, "FtdiSb", "Driver to use for programming. One of FtdiSb, FtdiUsb, FtdiMpsse");
 
 Status Driver::WriteTimedSequence(const TimedSequence &sequence) {
+  RETURN_IF_ERROR(QueueTimedSequence(sequence));
+  return FlushOutput();
+}
+
+Status Driver::QueueTimedSequence(const TimedSequence &sequence) {
+  // Steps without a delay are simply concatenated with the next step.
   for (const auto &step : sequence) {
     RETURN_IF_ERROR(WriteDatastring(step.data));
-    RETURN_IF_ERROR(FlushOutput());
-    Sleep(step.sleep);
+    if (step.sleep > ZeroDuration) {
+      RETURN_IF_ERROR(Delay(step.sleep));
+    }
   }
   return Status::OK;
 }
 
+Status Driver::Delay(Duration duration) {
+  RETURN_IF_ERROR(FlushOutput());
+  Sleep(duration);
+  return Status::OK;
+}
+
 Status Driver::WriteDatastring(const Datastring &data) {
   for (const uint8_t pins : data) {
     RETURN_IF_ERROR(SetPins(pins));
@@ -36,9 +53,39 @@ Status Driver::WriteDatastring(const Datastring &data) {
   return Status::OK;
 }
 
+Status Driver::WriteRepeated(const Datastring &data, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    RETURN_IF_ERROR(WriteDatastring(data));
+  }
+  return Status::OK;
+}
+
 std::unique_ptr<Driver> Driver::CreateFromFlags() {
-  if (FLAGS_driver == "FtdiSb") {
-    return std::make_unique<FtdiSbDriver>();
+  return CreateFromFlags(FtdiDeviceSelectorFromFlags());
+}
+
+std::unique_ptr<Driver> Driver::CreateFromFlags(const FtdiDeviceSelector &selector) {
+  const FtdiPins pins =
+      FLAGS_driver == "FtdiMpsse" ? FtdiMpssePinsFromFlags() : FtdiPinsFromFlags();
+  std::unique_ptr<Driver> driver;
+  Status status = Create(FLAGS_driver, selector, pins, &driver);
+  if (!status.ok()) {
+    FATAL("%s\n", status.message().c_str());
   }
-  FATAL("Unknown driver: %s\n", FLAGS_driver.c_str());
+  return driver;
+}
+
+Status Driver::Create(const std::string &name, const FtdiDeviceSelector &selector,
+                      const FtdiPins &pins, std::unique_ptr<Driver> *driver) {
+  RETURN_IF_ERROR(ValidateFtdiPins(pins));
+  if (name == "FtdiSb") {
+    *driver = std::make_unique<FtdiSbDriver>(selector, pins);
+  } else if (name == "FtdiUsb") {
+    *driver = std::make_unique<FtdiUsbDriver>(selector, pins);
+  } else if (name == "FtdiMpsse") {
+    *driver = std::make_unique<FtdiMpsseDriver>(selector, pins);
+  } else {
+    return Status(INVALID_ARGUMENT, strings::Cat("Unknown driver: ", name));
+  }
+  return Status::OK;
 }
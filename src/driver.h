@@ -21,19 +21,39 @@
 #include "status.h"
 
 class SequenceGenerator;
+struct FtdiDeviceSelector;
+struct FtdiPins;
 
 class Driver {
  public:
   virtual ~Driver() = default;
 
   static std::unique_ptr<Driver> CreateFromFlags();
+  // Creates the driver selected by the --driver flag, using selector to determine which device
+  // to open.
+  static std::unique_ptr<Driver> CreateFromFlags(const FtdiDeviceSelector &selector);
+  // Creates the driver named name (FtdiSb, FtdiUsb or FtdiMpsse), which opens the device selected
+  // by selector and uses pins to connect to the target.
+  static Status Create(const std::string &name, const FtdiDeviceSelector &selector,
+                       const FtdiPins &pins, std::unique_ptr<Driver> *driver);
 
   virtual Status Open() = 0;
   virtual void Close() = 0;
   virtual Status List(std::vector<std::string> *list) const = 0;
 
+  // When set, Close only releases the target, but keeps the programmer open such that a subsequent
+  // Open is fast. The programmer is closed when the driver is destroyed. Drivers may ignore this.
+  void set_keep_open(bool keep_open) { keep_open_ = keep_open; }
+
   Status WriteTimedSequence(const TimedSequence &sequence);
-  Status WriteDatastring(const Datastring &data);
+  // Like WriteTimedSequence, but leaves the output after the last delay queued, such that it is
+  // sent in the same stream as the following commands or read.
+  Status QueueTimedSequence(const TimedSequence &sequence);
+  // Writes the pin states in data. The default implementation calls SetPins for each byte.
+  virtual Status WriteDatastring(const Datastring &data);
+  // Writes the pin states in data count times. The default implementation calls WriteDatastring
+  // count times.
+  virtual Status WriteRepeated(const Datastring &data, uint32_t count);
 
   // FIXME: make the default argument explicit in the call sites and remove the default.
   virtual Status ReadWithSequence(const Datastring &sequence, const std::vector<int> &bit_offsets,
@@ -44,6 +64,11 @@ class Driver {
   Driver() = default;
   virtual Status SetPins(uint8_t pins) = 0;
   virtual Status FlushOutput() = 0;
+  // Holds the current pin state for at least duration. The default implementation flushes the
+  // output and sleeps on the host.
+  virtual Status Delay(Duration duration);
+
+  bool keep_open_ = false;
 
  private:
   Driver(const Driver &) = delete;
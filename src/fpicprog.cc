@@ -13,29 +13,33 @@
 */
 #include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <gflags/gflags.h>
+#include <map>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include "controller.h"
+#include "device_family.h"
 #include "driver.h"
+#include "ftdi_common.h"
 #include "high_level_controller.h"
-#include "pic16controller.h"
-#include "pic18controller.h"
-#include "pic24controller.h"
-#include "picnew8bitcontroller.h"
+#include "job_queue.h"
 #include "program.h"
-#include "sequence_generator.h"
+#include "server.h"
 #include "status.h"
 #include "strings.h"
 
 DEFINE_string(
     action, "",
-    "Action to perform. One of erase, dump-program, write-program, identify, list-programmers. "
-    "When using erase, dump-program or write-program, the --sections flag can be used to "
-    "indicate which sections to operate on. For write-program and dump-program an empty "
-    "flag means all sections, while for erase an explicit --sections=all must be passed.");
+    "Action to perform. One of erase, dump-program, write-program, verify, identify, "
+    "list-programmers, serve, auto. When using erase, dump-program, write-program or verify, the "
+    "--sections flag can be used to indicate which sections to operate on. For write-program, "
+    "verify and dump-program an empty flag means all sections, while for erase an explicit "
+    "--sections=all must be passed.");
 DEFINE_string(sections, "",
               "Comma separate list of sections to operate on. Possible values: either all "
               "or a combination of flash, user-id, config, eeprom.");
@@ -47,8 +51,38 @@ DEFINE_string(device, "",
               "which have a device ID should be detectable using the identify action.");
 
 DEFINE_string(output, "", "File to write the Intel HEX data to (--action=dump-program).");
-DEFINE_string(input, "", "Intel HEX file to read and program. (--action=write-program)");
-DEFINE_string(erase_mode, "chip", "Erase mode for writing. One of chip, section, none.");
+DEFINE_string(input, "",
+              "Intel HEX file to read and program or verify. (--action=write-program, "
+              "--action=verify)");
+DEFINE_string(erase_mode, "chip",
+              "Erase mode for writing. One of chip, section, row, none. The row mode only erases "
+              "and writes the flash rows that differ from the current contents.");
+DEFINE_string(ftdi_gang_interfaces, "",
+              "Interfaces of the FTDI device to program in parallel, e.g. ABCD for all "
+              "interfaces of an FT4232H. Each interface must be connected to a separate target. "
+              "Can not be used with the dump-program action.");
+DEFINE_string(ftdi_serials, "",
+              "Comma separated list of serial numbers of FTDI devices to program in parallel, "
+              "each connected to a separate target. Can be combined with --ftdi_gang_interfaces "
+              "to use multiple interfaces of each device. Can not be used with the dump-program "
+              "action.");
+DEFINE_string(jobs, "",
+              "File with jobs to perform, one per line, instead of a single action. Each job is "
+              "a whitespace separated list of key=value pairs, with keys action, family, "
+              "device, device_db, input, sections and erase_mode. The jobs are distributed over "
+              "the programmers selected by --ftdi_serials and --ftdi_gang_interfaces.");
+DEFINE_int32(auto_poll_interval_ms, 250,
+             "Interval between checks for the insertion or removal of a device (--action=auto).");
+DEFINE_string(socket, "",
+              "Path of the Unix domain socket to listen on for requests (--action=serve).");
+DEFINE_string(shadow_dir, "",
+              "Directory in which to keep a copy of the flash contents of each programmed "
+              "device. With --erase_mode=row, the copy is used instead of reading the flash.");
+DEFINE_int32(shadow_key_address, 0,
+             "Flash address of the serial number identifying devices in --shadow_dir.");
+DEFINE_int32(shadow_key_size, 0,
+             "Size of the serial number identifying devices in --shadow_dir. If 0, devices are "
+             "identified by their user ID.");
 DEFINE_string(device_db, "",
               "Device DB file to load. Defaults to "
 #if defined(DEVICE_DB_PATH)
@@ -57,132 +91,426 @@ DEFINE_string(device_db, "",
               "<path to binary>/device_db/<family>.lst.");
 #endif
 
-static EraseMode ParseEraseMode() {
-  if (FLAGS_erase_mode == "chip") {
-    return CHIP_ERASE;
-  } else if (FLAGS_erase_mode == "section") {
-    return SECTION_ERASE;
-  } else if (FLAGS_erase_mode == "none") {
-    return NO_ERASE;
-  } else {
-    fatal("No such erase mode '%s'\n", FLAGS_erase_mode.c_str());
+// Returns the Job described by the flags.
+static Job JobFromFlags() {
+  Job job;
+  job.action = FLAGS_action;
+  job.family = FLAGS_family;
+  job.device = FLAGS_device;
+  job.device_db = FLAGS_device_db;
+  job.input = FLAGS_input;
+  job.sections = FLAGS_sections;
+  job.erase_mode = FLAGS_erase_mode;
+  return job;
+}
+
+static Status ReadProgramFile(const std::string &filename, Program *program) {
+  FILE *in = fopen(filename.c_str(), "rb");
+  if (!in) {
+    return Status(FILE_NOT_FOUND,
+                  strings::Cat("Could not open file '", filename, "': ", strerror(errno)));
+  }
+  Status status = ReadIhex(program, in);
+  fclose(in);
+  return status;
+}
+
+// Performs the action described by job on the device connected through driver. Actions producing
+// a result to show, like identify, describe it in *report. It is left empty otherwise.
+static Status PerformAction(std::unique_ptr<Driver> driver,
+                            std::shared_ptr<const DeviceDb> device_db, const Job &job,
+                            const Program &program, std::string *report) {
+  std::unique_ptr<Controller> controller;
+  RETURN_IF_ERROR(CreateController(job.family, std::move(driver), &controller));
+  HighLevelController high_level_controller(std::move(controller), std::move(device_db));
+  if (!job.device.empty()) {
+    high_level_controller.SetDevice(job.device);
+  }
+  if (!FLAGS_shadow_dir.empty()) {
+    high_level_controller.SetShadow(FLAGS_shadow_dir, FLAGS_shadow_key_address,
+                                    FLAGS_shadow_key_size);
+  }
+
+  if (job.action == "erase") {
+    if (job.sections == "all") {
+      return high_level_controller.ChipErase();
+    } else {
+      return high_level_controller.SectionErase(ParseSections(job.sections));
+    }
+  } else if (job.action == "dump-program") {
+    Program dumped_program;
+    RETURN_IF_ERROR(
+        high_level_controller.ReadProgram(ParseSections(job.sections), &dumped_program));
+    FILE *out = fopen(FLAGS_output.c_str(), "w+b");
+    if (!out) {
+      return Status(FILE_NOT_FOUND,
+                    strings::Cat("Could not open file '", FLAGS_output, "': ", strerror(errno)));
+    }
+    WriteIhex(dumped_program, out);
+    fclose(out);
+    return Status::OK;
+  } else if (job.action == "write-program") {
+    return high_level_controller.WriteProgram(ParseSections(job.sections), program,
+                                              ParseEraseMode(job.erase_mode));
+  } else if (job.action == "verify") {
+    return high_level_controller.VerifyProgram(ParseSections(job.sections), program);
+  } else if (job.action == "identify") {
+    RETURN_IF_ERROR(high_level_controller.ReadDeviceInfo());
+    *report = strings::Cat("Device ", high_level_controller.device_info().name, ", revision ",
+                           high_level_controller.revision());
+    return Status::OK;
+  }
+  return Status(INVALID_ARGUMENT, strings::Cat("Unknown action '", job.action, "'"));
+}
+
+// A programmer used for parallel programming.
+struct Slot {
+  std::string name;
+  FtdiDeviceSelector selector;
+};
+
+// Returns the programmers selected by the --ftdi_serials and --ftdi_gang_interfaces flags.
+static std::vector<Slot> SlotsFromFlags() {
+  const FtdiDeviceSelector base_selector = FtdiDeviceSelectorFromFlags();
+  std::vector<std::string> serials = strings::Split<std::string>(FLAGS_ftdi_serials, ',', false);
+  if (serials.empty()) {
+    serials.push_back(base_selector.serial);
+  }
+  std::string interfaces = FLAGS_ftdi_gang_interfaces;
+  if (interfaces.empty()) {
+    interfaces = std::string(1, base_selector.interface);
+  }
+  std::vector<Slot> slots;
+  for (const std::string &serial : serials) {
+    for (char interface : interfaces) {
+      Slot slot;
+      slot.selector = base_selector;
+      slot.selector.serial = serial;
+      slot.selector.interface = interface;
+      if (!FLAGS_ftdi_serials.empty()) {
+        slot.name = serial;
+      }
+      if (!FLAGS_ftdi_gang_interfaces.empty() || slot.name.empty()) {
+        slot.name = strings::Cat(slot.name, slot.name.empty() ? "" : " ", "interface ",
+                                 std::string(1, interface));
+      }
+      slots.push_back(slot);
+    }
+  }
+  return slots;
+}
+
+// Combines the output of the threads programming in parallel. Messages are printed as whole lines
+// tagged with the name of the slot, and the progress of all slots is shown in a single status line.
+class ParallelOutput {
+ public:
+  explicit ParallelOutput(const std::vector<Slot> &slots)
+      : slots_(slots), partial_lines_(slots.size()), percentages_(slots.size(), -1) {}
+
+  // Installs the message and progress sinks for slot on the calling thread.
+  void InstallSinks(size_t slot) {
+    SetMessageSink([this, slot](const std::string &message) { Message(slot, message); });
+    SetProgressSink([this, slot](size_t done, size_t total) { Progress(slot, done, total); });
+  }
+
+  // Removes the status line. Must be called after all threads using the sinks have finished.
+  void Finish() { ClearStatus(); }
+
+ private:
+  void Message(size_t slot, const std::string &message) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string &line = partial_lines_[slot];
+    for (char c : message) {
+      if (c == '\r') {
+        // Carriage returns are only used to overwrite progress output.
+        line.clear();
+      } else if (c != '\n') {
+        line += c;
+      } else {
+        ClearStatus();
+        fprintf(stderr, "%s: %s\n", slots_[slot].name.c_str(), line.c_str());
+        line.clear();
+      }
+    }
+    PrintStatus();
+  }
+
+  void Progress(size_t slot, size_t done, size_t total) {
+    if (!will_print(1) || total == 0) {
+      return;
+    }
+    const int percentage = static_cast<int>(100 * done / total);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (percentages_[slot] == percentage) {
+      return;
+    }
+    percentages_[slot] = percentage;
+    PrintStatus();
+  }
+
+  void PrintStatus() {
+    std::string status;
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      if (percentages_[i] >= 0) {
+        status += strings::Cat(status.empty() ? "" : "  ", slots_[i].name, ": ", percentages_[i],
+                               "%");
+      }
+    }
+    // Pad with spaces to overwrite the previous status line.
+    fprintf(stderr, "\r%-*s", static_cast<int>(status_length_), status.c_str());
+    fflush(stderr);
+    status_length_ = status.size();
+  }
+
+  void ClearStatus() {
+    if (status_length_ > 0) {
+      fprintf(stderr, "\r%*s\r", static_cast<int>(status_length_), "");
+      fflush(stderr);
+      status_length_ = 0;
+    }
+  }
+
+  const std::vector<Slot> &slots_;
+  std::mutex mutex_;
+  std::vector<std::string> partial_lines_;
+  // Progress of each slot, or -1 if the slot has not reported any progress yet.
+  std::vector<int> percentages_;
+  size_t status_length_ = 0;
+};
+
+static double Seconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+// Returns the text to append to the result line of an action which produced report.
+static std::string ReportSuffix(const std::string &report) {
+  return report.empty() ? std::string() : strings::Cat(": ", report);
+}
+
+// Performs the action selected by the --action flag in parallel on each of the programmers
+// selected by the --ftdi_serials and --ftdi_gang_interfaces flags, using one thread per
+// programmer. Returns false if the action failed on any programmer.
+static bool PerformParallelAction(std::shared_ptr<const DeviceDb> device_db,
+                                  const Program &program) {
+  const std::vector<Slot> slots = SlotsFromFlags();
+  const Job job = JobFromFlags();
+  std::vector<Status> results(slots.size());
+  std::vector<std::string> reports(slots.size());
+  std::vector<std::chrono::steady_clock::duration> elapsed(slots.size());
+  ParallelOutput output(slots);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < slots.size(); ++i) {
+    threads.emplace_back([&slots, &job, &results, &reports, &elapsed, &output, device_db,
+                          &program, i] {
+      output.InstallSinks(i);
+      auto start = std::chrono::steady_clock::now();
+      results[i] = PerformAction(Driver::CreateFromFlags(slots[i].selector), device_db, job,
+                                 program, &reports[i]);
+      elapsed[i] = std::chrono::steady_clock::now() - start;
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  output.Finish();
+  bool success = true;
+  for (size_t i = 0; i < slots.size(); ++i) {
+    if (results[i].ok()) {
+      printf("%s: OK (%.1fs)%s\n", slots[i].name.c_str(), Seconds(elapsed[i]),
+             ReportSuffix(reports[i]).c_str());
+    } else {
+      printf("%s: FAILED (%.1fs) (%d) %s\n", slots[i].name.c_str(), Seconds(elapsed[i]),
+             results[i].code(), results[i].message().c_str());
+      success = false;
+    }
+  }
+  return success;
+}
+
+// Performs the jobs from the file selected by the --jobs flag, using one thread per programmer.
+// The jobs are initially distributed evenly over the programmers, but an idle programmer takes
+// over queued jobs from the other programmers. Device DBs and programs are loaded only once.
+// Returns false if any of the jobs failed.
+static bool PerformJobs(const std::string &binary_path) {
+  std::vector<Job> jobs;
+  CHECK_OK(LoadJobs(FLAGS_jobs, &jobs));
+
+  std::map<std::pair<std::string, std::string>, std::shared_ptr<const DeviceDb>> device_dbs;
+  std::map<std::string, std::shared_ptr<const Program>> programs;
+  std::vector<std::shared_ptr<const DeviceDb>> job_device_dbs;
+  std::vector<std::shared_ptr<const Program>> job_programs;
+  for (const Job &job : jobs) {
+    // Check the sections here, as ParseSections aborts on unknown names.
+    ParseSections(job.sections);
+    std::shared_ptr<const DeviceDb> &device_db = device_dbs[{job.family, job.device_db}];
+    if (!device_db) {
+      std::unique_ptr<DeviceDb> loaded_db;
+      CHECK_OK(LoadDeviceDb(job.family, job.device_db, binary_path, &loaded_db));
+      device_db = std::move(loaded_db);
+    }
+    job_device_dbs.push_back(device_db);
+    std::shared_ptr<const Program> &program = programs[job.input];
+    if (!program) {
+      auto loaded_program = std::make_shared<Program>();
+      if (!job.input.empty()) {
+        CHECK_OK(ReadProgramFile(job.input, loaded_program.get()));
+      }
+      program = std::move(loaded_program);
+    }
+    job_programs.push_back(program);
+  }
+
+  const std::vector<Slot> slots = SlotsFromFlags();
+  WorkStealingQueue queue(slots.size());
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    queue.Push(i % slots.size(), i);
+  }
+  std::vector<Status> results(jobs.size());
+  std::vector<std::string> reports(jobs.size());
+  std::vector<std::chrono::steady_clock::duration> elapsed(jobs.size());
+  std::vector<size_t> job_slots(jobs.size());
+  ParallelOutput output(slots);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < slots.size(); ++i) {
+    threads.emplace_back([&, i] {
+      output.InstallSinks(i);
+      size_t job;
+      while (queue.Pop(i, &job)) {
+        auto start = std::chrono::steady_clock::now();
+        results[job] =
+            PerformAction(Driver::CreateFromFlags(slots[i].selector), job_device_dbs[job],
+                          jobs[job], *job_programs[job], &reports[job]);
+        elapsed[job] = std::chrono::steady_clock::now() - start;
+        job_slots[job] = i;
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  output.Finish();
+  bool success = true;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const std::string &slot_name = slots[job_slots[i]].name;
+    if (results[i].ok()) {
+      printf("Job at line %d (%s): OK (%.1fs)%s\n", jobs[i].line, slot_name.c_str(),
+             Seconds(elapsed[i]), ReportSuffix(reports[i]).c_str());
+    } else {
+      printf("Job at line %d (%s): FAILED (%.1fs) (%d) %s\n", jobs[i].line, slot_name.c_str(),
+             Seconds(elapsed[i]), results[i].code(), results[i].message().c_str());
+      success = false;
+    }
+  }
+  return success;
+}
+
+// Repeatedly waits for a device to be connected, writes the program to it, and waits for the device
+// to be removed again. Only returns if the programmer fails.
+static Status PerformAuto(std::shared_ptr<const DeviceDb> device_db, const Program &program) {
+  std::unique_ptr<Driver> driver = Driver::CreateFromFlags();
+  // Keeping the programmer open makes polling for a device cheap.
+  driver->set_keep_open(true);
+  std::unique_ptr<Controller> controller;
+  RETURN_IF_ERROR(CreateController(FLAGS_family, std::move(driver), &controller));
+  HighLevelController high_level_controller(std::move(controller), std::move(device_db));
+  if (!FLAGS_device.empty()) {
+    high_level_controller.SetDevice(FLAGS_device);
+  }
+  if (!FLAGS_shadow_dir.empty()) {
+    high_level_controller.SetShadow(FLAGS_shadow_dir, FLAGS_shadow_key_address,
+                                    FLAGS_shadow_key_size);
+  }
+  const Duration poll_interval = MilliSeconds(std::max(FLAGS_auto_poll_interval_ms, 1));
+  const std::vector<Section> sections = ParseSections(FLAGS_sections);
+  const EraseMode erase_mode = ParseEraseMode(FLAGS_erase_mode);
+
+  while (true) {
+    printf("Waiting for device\n");
+    fflush(stdout);
+    bool present = false;
+    while (!present) {
+      Sleep(poll_interval);
+      RETURN_IF_ERROR(high_level_controller.ProbeDevice(&present));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Status status = high_level_controller.WriteProgram(sections, program, erase_mode);
+    double seconds = Seconds(std::chrono::steady_clock::now() - start);
+    const std::string &name = high_level_controller.device_info().name;
+    if (status.ok()) {
+      printf("%s: OK (%.1fs)\n", name.c_str(), seconds);
+    } else {
+      printf("%s: FAILED (%.1fs) (%d) %s\n", name.c_str(), seconds, status.code(),
+             status.message().c_str());
+    }
+    printf("Waiting for device removal\n");
+    fflush(stdout);
+
+    // Require two consecutive failed probes, to avoid rearming on a single bad read.
+    int absent_count = 0;
+    while (absent_count < 2) {
+      Sleep(poll_interval);
+      RETURN_IF_ERROR(high_level_controller.ProbeDevice(&present));
+      absent_count = present ? 0 : absent_count + 1;
+    }
   }
 }
 
 int main(int argc, char **argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  std::unique_ptr<Driver> driver = Driver::CreateFromFlags();
-  if (FLAGS_action.empty()) {
+  if (!FLAGS_jobs.empty()) {
+    return PerformJobs(argv[0]) ? EXIT_SUCCESS : EXIT_FAILURE;
+  } else if (FLAGS_action.empty()) {
     fatal("No action specified\n");
   } else if (FLAGS_action == "list-programmers") {
+    std::unique_ptr<Driver> driver = Driver::CreateFromFlags();
     std::vector<std::string> devices;
     CHECK_OK(driver->List(&devices));
     for (const auto &device : devices) {
       printf("Device:\n%s", device.c_str());
     }
     exit(0);
+  } else if (FLAGS_action == "serve") {
+    if (FLAGS_socket.empty()) {
+      fatal("--socket is required for action serve\n");
+    }
+    Server server(argv[0]);
+    server.SetShadow(FLAGS_shadow_dir, FLAGS_shadow_key_address, FLAGS_shadow_key_size);
+    CHECK_OK(server.Run(FLAGS_socket));
+    return EXIT_SUCCESS;
+  } else if (FLAGS_action == "erase" && FLAGS_sections.empty()) {
+    fatal("Erase requires setting --sections\n");
+  } else if (FLAGS_action == "dump-program" &&
+             (!FLAGS_ftdi_gang_interfaces.empty() || !FLAGS_ftdi_serials.empty())) {
+    fatal("Action dump-program can not be used with --ftdi_gang_interfaces or --ftdi_serials\n");
   }
 
-  // FIXME: move initialization of the device DB to a separate function to be called from both here
-  // and testgen.
-  std::unique_ptr<Controller> controller;
-  std::unique_ptr<DeviceDb> device_db;
   if (FLAGS_family.empty()) {
     fatal("--family must be specified\n");
-  } else if (FLAGS_family == "pic18") {
-    std::unique_ptr<Pic18SequenceGenerator> sequence_generator(new Pic18SequenceGenerator);
-    controller.reset(new Pic18Controller(std::move(driver), std::move(sequence_generator)));
-    device_db = std::make_unique<DeviceDb>(1, 1, Datastring{0xff},
-                                           [](const Datastring16 &) { return Status::OK; });
-  } else if (FLAGS_family == "pic18-new") {
-    std::unique_ptr<PicNew8BitSequenceGenerator> sequence_generator(
-        new PicNew8BitSequenceGenerator);
-    controller.reset(new PicNew8BitController(std::move(driver), std::move(sequence_generator),
-                                              PicNew8BitController::PIC18NEW));
-    device_db = std::make_unique<DeviceDb>(1, 1, Datastring{0xff},
-                                           [](const Datastring16 &) { return Status::OK; });
-  } else if (FLAGS_family == "pic10" || FLAGS_family == "pic12" || FLAGS_family == "pic16") {
-    std::unique_ptr<Pic16SequenceGenerator> sequence_generator(new Pic16SequenceGenerator);
-    controller.reset(new Pic16MidrangeController(std::move(driver), std::move(sequence_generator)));
-    device_db =
-        std::make_unique<DeviceDb>(2, 2, Datastring{0xff, 0x3f}, [](const Datastring16 &sequence) {
-          return Pic16SequenceGenerator::ValidateSequence(sequence);
-        });
-  } else if (FLAGS_family == "pic10-small" || FLAGS_family == "pic12-small" ||
-             FLAGS_family == "pic16-small") {
-    std::unique_ptr<Pic16SequenceGenerator> sequence_generator(new Pic16SequenceGenerator);
-    controller.reset(new Pic16BaselineController(std::move(driver), std::move(sequence_generator)));
-    device_db =
-        std::make_unique<DeviceDb>(2, 2, Datastring{0xff, 0x0f}, [](const Datastring16 &sequence) {
-          return Pic16SequenceGenerator::ValidateSequence(sequence);
-        });
-  } else if (FLAGS_family == "pic16-new") {
-    std::unique_ptr<PicNew8BitSequenceGenerator> sequence_generator(
-        new PicNew8BitSequenceGenerator);
-    controller.reset(new PicNew8BitController(std::move(driver), std::move(sequence_generator),
-                                              PicNew8BitController::PIC16NEW));
-    device_db =
-        std::make_unique<DeviceDb>(2, 2, Datastring{0xff, 0x3f}, [](const Datastring16 &sequence) {
-          return Pic16SequenceGenerator::ValidateSequence(sequence);
-        });
-  } else if (FLAGS_family == "pic24") {
-    std::unique_ptr<Pic24SequenceGenerator> sequence_generator(new Pic24SequenceGenerator);
-    controller.reset(new Pic24Controller(std::move(driver), std::move(sequence_generator)));
-    device_db = std::make_unique<DeviceDb>(4, 2, Datastring{0xff, 0xff, 0xff, 0x00},
-                                           [](const Datastring16 &) { return Status::OK; });
-  } else {
-    fatal("Unknown device family %s.\n", FLAGS_family.c_str());
-  }
-
-  std::string filename = FLAGS_device_db;
-  if (filename.empty()) {
-#if defined(DEVICE_DB_PATH)
-    filename = strings::Cat(DEVICE_DB_PATH, "/", FLAGS_family, ".lst");
-#else
-    filename = strings::Cat(Dirname(argv[0]), "/device_db/", FLAGS_family, ".lst");
-#endif
   }
-  CHECK_OK(device_db->Load(filename));
+  std::unique_ptr<DeviceDb> device_db;
+  CHECK_OK(LoadDeviceDb(FLAGS_family, FLAGS_device_db, argv[0], &device_db));
 
-  HighLevelController high_level_controller(std::move(controller), std::move(device_db));
-  if (!FLAGS_device.empty()) {
-    high_level_controller.SetDevice(FLAGS_device);
+  Program program;
+  if (FLAGS_action == "write-program" || FLAGS_action == "verify" || FLAGS_action == "auto") {
+    if (FLAGS_input.empty()) {
+      fatal("--input is required for action %s\n", FLAGS_action.c_str());
+    }
+    CHECK_OK(ReadProgramFile(FLAGS_input, &program));
   }
 
-  if (FLAGS_action == "erase") {
-    if (FLAGS_sections.empty()) {
-      fatal("Erase requires setting --sections\n");
-    } else if (FLAGS_sections == "all") {
-      CHECK_OK(high_level_controller.ChipErase());
-    } else {
-      CHECK_OK(high_level_controller.SectionErase(ParseSections(FLAGS_sections)));
-    }
-  } else if (FLAGS_action == "dump-program") {
-    Program program;
-    CHECK_OK(high_level_controller.ReadProgram(ParseSections(FLAGS_sections), &program));
-    FILE *out = fopen(FLAGS_output.c_str(), "w+b");
-    if (!out) {
-      fatal("Could not open file '%s': %s\n", FLAGS_output.c_str(), strerror(errno));
-    }
-    WriteIhex(program, out);
-    fclose(out);
-  } else if (FLAGS_action == "write-program") {
-    if (FLAGS_input.empty()) {
-      fatal("--input is required for action write-program\n");
-    }
-    Program program;
-    FILE *in = fopen(FLAGS_input.c_str(), "rb");
-    if (!in) {
-      fatal("Could not open file '%s': %s\n", FLAGS_input.c_str(), strerror(errno));
-    }
-    CHECK_OK(ReadIhex(&program, in));
-    CHECK_OK(high_level_controller.WriteProgram(ParseSections(FLAGS_sections), program,
-                                                ParseEraseMode()));
-  } else if (FLAGS_action == "identify") {
-    CHECK_OK(high_level_controller.Identify());
-  } else {
-    fatal("Unknown action '%s'\n", FLAGS_action.c_str());
+  if (FLAGS_action == "auto") {
+    CHECK_OK(PerformAuto(std::move(device_db), program));
+  }
+  if (!FLAGS_ftdi_gang_interfaces.empty() || !FLAGS_ftdi_serials.empty()) {
+    return PerformParallelAction(std::move(device_db), program) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  std::string report;
+  CHECK_OK(PerformAction(Driver::CreateFromFlags(), std::move(device_db), JobFromFlags(), program,
+                         &report));
+  if (!report.empty()) {
+    printf("%s\n", report.c_str());
   }
   return EXIT_SUCCESS;
 }
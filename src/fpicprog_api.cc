@@ -0,0 +1,214 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "fpicprog_api.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+
+#include "device_db.h"
+#include "device_family.h"
+#include "driver.h"
+#include "ftdi_common.h"
+#include "ftdi_mpsse.h"
+#include "high_level_controller.h"
+#include "program.h"
+#include "status.h"
+#include "strings.h"
+#include "util.h"
+
+static_assert(std::is_same<ProgramData, Program>::value, "ProgramData must be the same as Program");
+
+struct Operation::State {
+  std::atomic<bool> cancel{false};
+  std::atomic<size_t> progress_done{0};
+  std::atomic<size_t> progress_total{0};
+};
+
+namespace {
+
+// Creates the driver described by options. Empty pin names are replaced by the defaults of the
+// driver.
+Status CreateDriver(const ProgrammerOptions &options, std::unique_ptr<Driver> *driver) {
+  FtdiDeviceSelector selector;
+  selector.vendor_id = options.vendor_id;
+  selector.product_id = options.product_id;
+  selector.description = options.description;
+  selector.serial = options.serial;
+  selector.interface = options.interface;
+
+  FtdiPins pins = options.driver == "FtdiMpsse" ? FtdiMpsseDefaultPins() : FtdiPins();
+  auto set_pin = [](const std::string &name, std::string *pin) {
+    if (!name.empty()) {
+      *pin = name;
+    }
+  };
+  set_pin(options.nMCLR, &pins.nMCLR);
+  set_pin(options.PGM, &pins.PGM);
+  set_pin(options.PGC, &pins.PGC);
+  set_pin(options.PGD, &pins.PGD);
+  set_pin(options.PGD_in, &pins.PGD_in);
+  pins.lockstep_PGD = options.lockstep_PGD;
+  return Driver::Create(options.driver, selector, pins, driver);
+}
+
+// Checks the options which ParseSections and ParseEraseMode don't report as errors.
+Status ValidateOptions(const OperationOptions &options) {
+  for (const std::string &section : strings::Split<std::string>(options.sections, ',', false)) {
+    if (section != "all" && section != "flash" && section != "user-id" && section != "config" &&
+        section != "eeprom") {
+      return Status(INVALID_ARGUMENT, strings::Cat("Unknown section name ", section));
+    }
+  }
+  if (options.erase_mode != "chip" && options.erase_mode != "section" &&
+      options.erase_mode != "row" && options.erase_mode != "none") {
+    return Status(INVALID_ARGUMENT, strings::Cat("No such erase mode '", options.erase_mode, "'"));
+  }
+  return Status::OK;
+}
+
+}  // namespace
+
+Operation::~Operation() {
+  Cancel();
+  result_.wait();
+}
+
+std::unique_ptr<Operation> Operation::StartIdentify(const ProgrammerOptions &programmer,
+                                                    const OperationOptions &options,
+                                                    CompletionCallback callback) {
+  return Start(programmer, options,
+               [](HighLevelController *controller, OperationResult *) {
+                 return controller->ReadDeviceInfo();
+               },
+               std::move(callback));
+}
+
+std::unique_ptr<Operation> Operation::StartReadProgram(const ProgrammerOptions &programmer,
+                                                       const OperationOptions &options,
+                                                       CompletionCallback callback) {
+  return Start(programmer, options,
+               [options](HighLevelController *controller, OperationResult *result) {
+                 return controller->ReadProgram(ParseSections(options.sections), &result->program);
+               },
+               std::move(callback));
+}
+
+std::unique_ptr<Operation> Operation::StartWriteProgram(const ProgrammerOptions &programmer,
+                                                        const OperationOptions &options,
+                                                        std::shared_ptr<const ProgramData> program,
+                                                        CompletionCallback callback) {
+  return Start(programmer, options,
+               [options, program](HighLevelController *controller, OperationResult *) {
+                 if (!program) {
+                   return Status(INVALID_ARGUMENT, "No program to write");
+                 }
+                 return controller->WriteProgram(ParseSections(options.sections), *program,
+                                                 ParseEraseMode(options.erase_mode));
+               },
+               std::move(callback));
+}
+
+std::unique_ptr<Operation> Operation::StartVerifyProgram(const ProgrammerOptions &programmer,
+                                                         const OperationOptions &options,
+                                                         std::shared_ptr<const ProgramData> program,
+                                                         CompletionCallback callback) {
+  return Start(programmer, options,
+               [options, program](HighLevelController *controller, OperationResult *) {
+                 if (!program) {
+                   return Status(INVALID_ARGUMENT, "No program to verify");
+                 }
+                 return controller->VerifyProgram(ParseSections(options.sections), *program);
+               },
+               std::move(callback));
+}
+
+std::unique_ptr<Operation> Operation::StartErase(const ProgrammerOptions &programmer,
+                                                 const OperationOptions &options,
+                                                 CompletionCallback callback) {
+  return Start(programmer, options,
+               [options](HighLevelController *controller, OperationResult *) {
+                 if (options.sections == "all") {
+                   return controller->ChipErase();
+                 }
+                 return controller->SectionErase(ParseSections(options.sections));
+               },
+               std::move(callback));
+}
+
+bool Operation::done() const {
+  return result_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+const OperationResult &Operation::Wait() const { return result_.get(); }
+
+void Operation::GetProgress(size_t *done, size_t *total) const {
+  *done = state_->progress_done;
+  *total = state_->progress_total;
+}
+
+void Operation::Cancel() { state_->cancel = true; }
+
+std::unique_ptr<Operation> Operation::Start(const ProgrammerOptions &programmer,
+                                            const OperationOptions &options, Action action,
+                                            CompletionCallback callback) {
+  auto state = std::make_shared<State>();
+  auto promise = std::make_shared<std::promise<OperationResult>>();
+  std::shared_future<OperationResult> future = promise->get_future().share();
+  // The thread only uses the shared state, such that the callback can destroy the Operation.
+  std::thread([state, promise, future, programmer, options, action, callback] {
+    SetMessageSink(options.message_sink ? options.message_sink : [](const std::string &) {});
+    SetProgressSink([&state](size_t done, size_t total) {
+      state->progress_done = done;
+      state->progress_total = total;
+    });
+
+    OperationResult result;
+    std::unique_ptr<Driver> driver;
+    std::unique_ptr<Controller> controller;
+    std::unique_ptr<DeviceDb> device_db;
+    Status status = ValidateOptions(options);
+    if (status.ok()) {
+      status = CreateDriver(programmer, &driver);
+    }
+    if (status.ok()) {
+      status = LoadDeviceDb(options.family, options.device_db, "", &device_db);
+    }
+    if (status.ok()) {
+      status = CreateController(options.family, std::move(driver), &controller);
+    }
+    if (status.ok()) {
+      HighLevelController high_level_controller(std::move(controller), std::move(device_db));
+      if (!options.device.empty()) {
+        high_level_controller.SetDevice(options.device);
+      }
+      high_level_controller.SetCancelFlag(&state->cancel);
+      status = action(&high_level_controller, &result);
+      result.device_name = high_level_controller.device_info().name;
+      result.device_id = high_level_controller.device_info().device_id;
+      result.revision = high_level_controller.revision();
+    }
+    result.code = status.code();
+    result.message = status.message();
+
+    SetMessageSink(nullptr);
+    SetProgressSink(nullptr);
+    promise->set_value(std::move(result));
+    if (callback) {
+      callback(future.get());
+    }
+  }).detach();
+  return std::unique_ptr<Operation>(new Operation(std::move(state), std::move(future)));
+}
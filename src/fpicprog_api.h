@@ -0,0 +1,150 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FPICPROG_API_H_
+#define FPICPROG_API_H_
+
+// Interface for using fpicprog as a library (libfpicprog). Each operation runs on its own thread,
+// and is controlled through the returned Operation. Progress, messages and results are reported as
+// data, rather than printed. This header only uses standard library types, and does not depend on
+// the command line flags of fpicprog.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+
+class HighLevelController;
+class Status;
+
+// The contents of device memory or of a hex file, as blocks of bytes keyed by their start address.
+typedef std::map<uint32_t, std::basic_string<uint8_t>> ProgramData;
+
+// Selects the programmer, and the pins connecting it to the target. These correspond to the
+// --driver and --ftdi_* command line flags. Other driver settings use the defaults of their flags.
+struct ProgrammerOptions {
+  // One of FtdiSb, FtdiUsb or FtdiMpsse.
+  std::string driver = "FtdiSb";
+  // If 0, the FTDI vendor ID is used.
+  int vendor_id = 0;
+  // If 0, the default product IDs of the driver are tried.
+  int product_id = 0;
+  std::string description;
+  std::string serial;
+  // Interface to use, for devices which have multiple interfaces. One of A, B, C or D.
+  char interface = 'A';
+  // Names of the pins (TxD, RxD, RTS, CTS, DTR, DSR, DCD or RI) connected to the target. nMCLR and
+  // PGM may be NC if not connected. An empty name selects the default pin of the driver.
+  std::string nMCLR;
+  std::string PGM;
+  std::string PGC;
+  std::string PGD;
+  std::string PGD_in;
+  // Comma separated list of PGD pins of additional targets programmed in lockstep.
+  std::string lockstep_PGD;
+};
+
+// Parameters of an operation. These correspond to the command line flags with the same names.
+struct OperationOptions {
+  std::string family;
+  // Device DB file to load. If empty, the device DB installed for the family is used.
+  std::string device_db;
+  // Name of the device. If empty, the device is identified by its device ID.
+  std::string device;
+  // Comma separated list of sections (flash, user-id, config and eeprom), or all.
+  std::string sections = "all";
+  // One of chip, section, row or none.
+  std::string erase_mode = "chip";
+  // Receives the messages that the command line tool prints, on the thread of the operation. If
+  // not set, the messages are discarded.
+  std::function<void(const std::string &message)> message_sink;
+};
+
+struct OperationResult {
+  // The error code (see status.h), or 0 if the operation succeeded.
+  int code = 0;
+  std::string message;
+  // The device found, if the operation got as far as identifying it.
+  std::string device_name;
+  uint16_t device_id = 0;
+  uint16_t revision = 0;
+  // The data read by a read operation.
+  ProgramData program;
+
+  bool ok() const { return code == 0; }
+};
+
+class Operation {
+ public:
+  // Called on the thread of the operation when it completes. The result is available through
+  // Wait() before the callback is called, so the callback may destroy the Operation.
+  typedef std::function<void(const OperationResult &result)> CompletionCallback;
+
+  // Cancels the operation if it is still running, and waits for its result. Must not be called
+  // from within a message sink, as the operation can't complete until the sink returns.
+  ~Operation();
+
+  // Starts an operation on the device connected to the programmer selected by programmer. Invalid
+  // options are reported through the result of the operation. For write and verify operations,
+  // program holds the data to write or compare, and must not be null. Erase operations erase the
+  // whole chip if options.sections is all, and the selected sections otherwise.
+  static std::unique_ptr<Operation> StartIdentify(const ProgrammerOptions &programmer,
+                                                  const OperationOptions &options,
+                                                  CompletionCallback callback = nullptr);
+  static std::unique_ptr<Operation> StartReadProgram(const ProgrammerOptions &programmer,
+                                                     const OperationOptions &options,
+                                                     CompletionCallback callback = nullptr);
+  static std::unique_ptr<Operation> StartWriteProgram(const ProgrammerOptions &programmer,
+                                                      const OperationOptions &options,
+                                                      std::shared_ptr<const ProgramData> program,
+                                                      CompletionCallback callback = nullptr);
+  static std::unique_ptr<Operation> StartVerifyProgram(const ProgrammerOptions &programmer,
+                                                       const OperationOptions &options,
+                                                       std::shared_ptr<const ProgramData> program,
+                                                       CompletionCallback callback = nullptr);
+  static std::unique_ptr<Operation> StartErase(const ProgrammerOptions &programmer,
+                                               const OperationOptions &options,
+                                               CompletionCallback callback = nullptr);
+
+  // Returns true if the operation has completed.
+  bool done() const;
+  // Waits for the operation to complete, and returns its result. May be called multiple times,
+  // and from multiple threads.
+  const OperationResult &Wait() const;
+  // Retrieves the progress of the current step of the operation (e.g. writing a section). May be
+  // called from any thread while the operation is running.
+  void GetProgress(size_t *done, size_t *total) const;
+  // Requests the operation to stop. If it stops before completing, its result has the code for
+  // CANCELLED.
+  void Cancel();
+
+ private:
+  // The state shared with the thread of the operation, which may outlive the Operation.
+  struct State;
+  typedef std::function<Status(HighLevelController *controller, OperationResult *result)> Action;
+
+  Operation(std::shared_ptr<State> state, std::shared_future<OperationResult> result)
+      : state_(std::move(state)), result_(std::move(result)) {}
+
+  static std::unique_ptr<Operation> Start(const ProgrammerOptions &programmer,
+                                          const OperationOptions &options, Action action,
+                                          CompletionCallback callback);
+
+  std::shared_ptr<State> state_;
+  std::shared_future<OperationResult> result_;
+};
+
+#endif
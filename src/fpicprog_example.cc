@@ -0,0 +1,62 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Example of using libfpicprog: identifies the device connected to the default programmer, and
+// reads its flash while printing the progress.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "fpicprog_api.h"
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: fpicprog_example <family>\n");
+    return EXIT_FAILURE;
+  }
+  ProgrammerOptions programmer;
+  OperationOptions options;
+  options.family = argv[1];
+  options.message_sink = [](const std::string &message) { fputs(message.c_str(), stderr); };
+
+  std::unique_ptr<Operation> identify = Operation::StartIdentify(programmer, options);
+  const OperationResult &identified = identify->Wait();
+  if (!identified.ok()) {
+    fprintf(stderr, "Identify failed: %s\n", identified.message.c_str());
+    return EXIT_FAILURE;
+  }
+  printf("Device %s, revision %u\n", identified.device_name.c_str(), identified.revision);
+
+  options.device = identified.device_name;
+  options.sections = "flash";
+  std::unique_ptr<Operation> read = Operation::StartReadProgram(programmer, options);
+  while (!read->done()) {
+    size_t done, total;
+    read->GetProgress(&done, &total);
+    if (total > 0) {
+      fprintf(stderr, "\r%.0f%%", 100.0 * done / total);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  fprintf(stderr, "\r");
+  const OperationResult &read_result = read->Wait();
+  if (!read_result.ok()) {
+    fprintf(stderr, "Read failed: %s\n", read_result.message.c_str());
+    return EXIT_FAILURE;
+  }
+  for (const auto &block : read_result.program) {
+    printf("%06X: %zu bytes\n", block.first, block.second.size());
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "ftdi_common.h"
+
+#include <gflags/gflags.h>
+#include <mutex>
+
+#include "strings.h"
+#include "util.h"
+
+DEFINE_int32(ftdi_vendor_id, 0, "Vendor ID of the device to open. Defaults to FTDI vendor ID.");
+DEFINE_int32(ftdi_product_id, 0,
+             "Product ID of the device to open. Defaults to trying all known FTDI product IDs "
+             "for the FtdiSb driver, and the H-series product IDs for the FtdiMpsse driver.");
+DEFINE_string(ftdi_description, "", "Product description to select which FTDI device to use.");
+DEFINE_string(ftdi_serial, "", "Serial number to select which FTDI device to use.");
+DEFINE_string(ftdi_program_interface, "A",
+              "Interface to use on the FTDI device, for devices which have multiple interfaces "
+              "(e.g. FT4232H). Possible values are A, B, C, or D.");
+DEFINE_string(ftdi_nMCLR, "TxD", "Pin to use for inverted MCLR.");
+DEFINE_string(ftdi_PGC, "DTR", "Pin to use for PGC");
+DEFINE_string(ftdi_PGD_in, "", "Pin to use for PGD input if using split input");
+DEFINE_string(ftdi_PGD, "RxD", "Pin to use for PGD");
+DEFINE_string(ftdi_PGM, "CTS", "Pin to use for PGM");
+DEFINE_string(ftdi_lockstep_PGD, "",
+              "Comma separated list of additional pins to use as PGD for identical targets that "
+              "are programmed in lockstep with the FtdiSb driver. The other pins are shared "
+              "between the targets. Data read from each target must match the first target.");
+
+namespace {
+
+struct Pin {
+  const char *name;
+  int number;
+};
+
+// Serializes the enumeration and opening of devices by parallel workers. Opening a device
+// involves a number of control transfers, which some hosts and hubs handle poorly when they are
+// interleaved with the enumeration of other devices.
+std::mutex open_mutex;
+
+const Pin pins[] = {
+    {"TxD", 0}, {"RxD", 1}, {"RTS", 2}, {"CTS", 3}, {"DTR", 4}, {"DSR", 5}, {"DCD", 6}, {"RI", 7},
+};
+
+// Returns the pin named name, or nullptr if there is no such pin.
+const Pin *FindPin(const std::string &name) {
+  for (const Pin &pin : pins) {
+    if (name == pin.name) {
+      return &pin;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+FtdiDeviceSelector FtdiDeviceSelectorFromFlags() {
+  FtdiDeviceSelector selector;
+  selector.vendor_id = FLAGS_ftdi_vendor_id;
+  selector.product_id = FLAGS_ftdi_product_id;
+  selector.description = FLAGS_ftdi_description;
+  selector.serial = FLAGS_ftdi_serial;
+  selector.interface =
+      FLAGS_ftdi_program_interface.size() == 1 ? FLAGS_ftdi_program_interface[0] : '?';
+  return selector;
+}
+
+FtdiPins FtdiPinsFromFlags() {
+  FtdiPins ftdi_pins;
+  ftdi_pins.nMCLR = FLAGS_ftdi_nMCLR;
+  ftdi_pins.PGM = FLAGS_ftdi_PGM;
+  ftdi_pins.PGC = FLAGS_ftdi_PGC;
+  ftdi_pins.PGD = FLAGS_ftdi_PGD;
+  ftdi_pins.PGD_in = FLAGS_ftdi_PGD_in;
+  ftdi_pins.lockstep_PGD = FLAGS_ftdi_lockstep_PGD;
+  return ftdi_pins;
+}
+
+Status ValidateFtdiPins(const FtdiPins &ftdi_pins) {
+  std::vector<std::string> names =
+      strings::Split<std::string>(ftdi_pins.lockstep_PGD, ',', false);
+  names.push_back(ftdi_pins.PGC);
+  names.push_back(ftdi_pins.PGD);
+  if (!ftdi_pins.PGD_in.empty()) {
+    names.push_back(ftdi_pins.PGD_in);
+  }
+  if (ftdi_pins.nMCLR != "NC") {
+    names.push_back(ftdi_pins.nMCLR);
+  }
+  if (ftdi_pins.PGM != "NC") {
+    names.push_back(ftdi_pins.PGM);
+  }
+  for (const std::string &name : names) {
+    if (!FindPin(name)) {
+      return Status(INVALID_ARGUMENT, strings::Cat("No pin named ", name, " available"));
+    }
+  }
+  return Status::OK;
+}
+
+Status OpenFtdiDevice(ftdi_context *ftdic, const FtdiDeviceSelector &selector,
+                      const std::vector<int> &default_product_ids) {
+  if (ftdi_init(ftdic) < 0) {
+    return Status(Code::INIT_FAILED, strings::Cat("Couldn't initialize ftdi_context struct: ",
+                                                  ftdi_get_error_string(ftdic)));
+  }
+  if (selector.interface < 'A' || selector.interface > 'D') {
+    AutoClosureRunner deinit([ftdic] { ftdi_deinit(ftdic); });
+    return Status(Code::INVALID_ARGUMENT,
+                  strings::Cat("Invalid interface '", std::string(1, selector.interface),
+                               "' specified"));
+  }
+  if (ftdi_set_interface(ftdic, static_cast<ftdi_interface>(selector.interface - 'A' + 1)) < 0) {
+    AutoClosureRunner deinit([ftdic] { ftdi_deinit(ftdic); });
+    return Status(Code::INIT_FAILED,
+                  strings::Cat("Couldn't set FTDI interface: ", ftdi_get_error_string(ftdic)));
+  }
+
+  std::vector<int> product_ids = default_product_ids;
+  if (selector.product_id != 0) {
+    product_ids = {selector.product_id};
+  }
+  const char *description = selector.description.empty() ? nullptr : selector.description.c_str();
+  const char *serial = selector.serial.empty() ? nullptr : selector.serial.c_str();
+  std::lock_guard<std::mutex> lock(open_mutex);
+  for (int product_id : product_ids) {
+    if (ftdi_usb_open_desc(ftdic, selector.vendor_id == 0 ? 0x0403 : selector.vendor_id,
+                           product_id, description, serial) == 0) {
+      return Status::OK;
+    }
+  }
+  AutoClosureRunner deinit([ftdic] { ftdi_deinit(ftdic); });
+  return Status(Code::INIT_FAILED,
+                strings::Cat("Couldn't open FTDI device: ", ftdi_get_error_string(ftdic)));
+}
+
+Status ListFtdiDevices(std::vector<std::string> *list) {
+  ftdi_context ftdic;
+  if (ftdi_init(&ftdic) < 0) {
+    return Status(Code::INIT_FAILED, strings::Cat("Couldn't initialize ftdi_context struct: ",
+                                                  ftdi_get_error_string(&ftdic)));
+  }
+  ftdi_device_list *device_list = nullptr;
+  int num_devices;
+  std::lock_guard<std::mutex> lock(open_mutex);
+  int vendor_id = 0x0403;
+  for (int product_id : {0x6001, 0x6010, 0x6011, 0x6014, 0x6015}) {
+    if ((num_devices = ftdi_usb_find_all(&ftdic, &device_list, vendor_id, product_id)) < 0) {
+      return Status(Code::INIT_FAILED,
+                    strings::Cat("Could not list devices: ", ftdi_get_error_string(&ftdic)));
+    }
+    for (ftdi_device_list *ptr = device_list; ptr != nullptr; ptr = ptr->next) {
+      char description[1024];
+      char serial[1024];
+      if (ftdi_usb_get_strings(&ftdic, ptr->dev, nullptr, 0, description, sizeof(description),
+                               serial, sizeof(serial)) < 0) {
+        return Status(Code::INIT_FAILED, strings::Cat("Error getting device strings: ",
+                                                      ftdi_get_error_string(&ftdic)));
+      }
+      list->push_back(strings::Cat("Vendor ID: 0x", HexUint16(vendor_id), "\nProduct ID: 0x",
+                                   HexUint16(product_id), "\nDescription: ", description,
+                                   "\nSerial: ", serial, "\n"));
+    }
+    ftdi_list_free(&device_list);
+  }
+  return Status::OK;
+}
+
+uint8_t FtdiPinNameToValue(const std::string &name) {
+  const Pin *pin = FindPin(name);
+  if (!pin) {
+    FATAL("No pin named %s available.\n", name.c_str());
+  }
+  return 1 << pin->number;
+}
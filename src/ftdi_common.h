@@ -0,0 +1,68 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FTDI_COMMON_H_
+#define FTDI_COMMON_H_
+
+#include <libftdi1/ftdi.h>
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+// Parameters determining which FTDI device (and interface) to open.
+struct FtdiDeviceSelector {
+  // If 0, the FTDI vendor ID is used.
+  int vendor_id = 0;
+  // If 0, the default product IDs of the driver are tried.
+  int product_id = 0;
+  std::string description;
+  std::string serial;
+  // Interface to use, for devices which have multiple interfaces. One of A, B, C or D.
+  char interface = 'A';
+};
+
+// Returns the FtdiDeviceSelector described by the --ftdi_* flags.
+FtdiDeviceSelector FtdiDeviceSelectorFromFlags();
+
+// Names of the pins of the FTDI device connected to the target (see FtdiPinNameToValue).
+struct FtdiPins {
+  // Either of these may be NC if not connected.
+  std::string nMCLR = "TxD";
+  std::string PGM = "CTS";
+  std::string PGC = "DTR";
+  std::string PGD = "RxD";
+  // Pin to use for the PGD input if using split input. If empty, PGD is used.
+  std::string PGD_in;
+  // Comma separated list of PGD pins of additional targets programmed in lockstep.
+  std::string lockstep_PGD;
+};
+
+// Returns the FtdiPins described by the --ftdi_* flags.
+FtdiPins FtdiPinsFromFlags();
+// Checks that all pin names in ftdi_pins are known.
+Status ValidateFtdiPins(const FtdiPins &ftdi_pins);
+
+// Initializes ftdic and opens the FTDI device selected by selector. If no product ID was
+// specified, each of the default_product_ids is tried in turn. On failure, ftdic is deinitialized
+// again.
+Status OpenFtdiDevice(ftdi_context *ftdic, const FtdiDeviceSelector &selector,
+                      const std::vector<int> &default_product_ids);
+
+// Lists all FTDI devices attached to the system that can be used by the FTDI based drivers.
+Status ListFtdiDevices(std::vector<std::string> *list);
+
+// Converts a pin name (TxD, RxD, RTS, CTS, DTR, DSR, DCD or RI) to the bit value for that pin.
+uint8_t FtdiPinNameToValue(const std::string &name);
+
+#endif
@@ -0,0 +1,397 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "ftdi_mpsse.h"
+
+#include <algorithm>
+#include <cstring>
+#include <gflags/gflags.h>
+
+#include "ftdi_common.h"
+#include "status.h"
+#include "strings.h"
+
+// The MPSSE engine uses TxD, RxD and RTS, so the defaults for nMCLR and PGM differ from those of
+// the bitbang drivers.
+static constexpr char kDefaultNmclrPin[] = "DTR";
+static constexpr char kDefaultPgmPin[] = "CTS";
+
+DEFINE_string(ftdi_mpsse_nMCLR, kDefaultNmclrPin,
+              "Pin to use for inverted MCLR with the FtdiMpsse driver. TxD, RxD and RTS are "
+              "reserved for PGC, PGD and PGD input respectively.");
+DEFINE_string(ftdi_mpsse_PGM, kDefaultPgmPin, "Pin to use for PGM with the FtdiMpsse driver.");
+DEFINE_int32(ftdi_mpsse_clock_khz, 1000, "PGC clock frequency in kHz for the FtdiMpsse driver.");
+
+namespace {
+
+// Fixed pin assignments of the MPSSE engine.
+constexpr uint8_t kTck = 1 << 0;
+constexpr uint8_t kTdi = 1 << 1;
+constexpr uint8_t kTdo = 1 << 2;
+
+// The maximum number of bytes that can be clocked using a single MPSSE command.
+constexpr size_t kMaxClockBytes = 65536;
+// Time for which all pins are held low when closing, to ensure the target is reset.
+constexpr Duration kResetTime = MilliSeconds(100);
+
+enum ClockMode {
+  NO_CLOCK,
+  // Data is set together with the rising edge of PGC, and the target latches it on the falling
+  // edge. Data from the target is sampled while PGC is high.
+  CLOCK_UP_DOWN,
+  // Data is set while PGC is low, and the target latches it on the rising edge. Data from the
+  // target is sampled while PGC is low.
+  CLOCK_DOWN_UP,
+};
+
+ClockMode GetClockMode(const Datastring &sequence, size_t idx) {
+  if (idx + 1 >= sequence.size()) {
+    return NO_CLOCK;
+  }
+  uint8_t first = sequence[idx];
+  uint8_t second = sequence[idx + 1];
+  if ((first & PGC) && second == (first & ~PGC)) {
+    return CLOCK_UP_DOWN;
+  } else if (!(first & PGC) && second == (first | PGC)) {
+    return CLOCK_DOWN_UP;
+  }
+  return NO_CLOCK;
+}
+
+}  // namespace
+
+FtdiPins FtdiMpsseDefaultPins() {
+  FtdiPins pins;
+  pins.nMCLR = kDefaultNmclrPin;
+  pins.PGM = kDefaultPgmPin;
+  pins.PGC = "TxD";
+  pins.PGD = "RxD";
+  pins.PGD_in = "RTS";
+  return pins;
+}
+
+FtdiPins FtdiMpssePinsFromFlags() {
+  FtdiPins pins = FtdiMpsseDefaultPins();
+  pins.nMCLR = FLAGS_ftdi_mpsse_nMCLR;
+  pins.PGM = FLAGS_ftdi_mpsse_PGM;
+  return pins;
+}
+
+Status FtdiMpsseDriver::Open() {
+  if (open_) return Status(INIT_FAILED, "Device already open");
+  if (!pins_.lockstep_PGD.empty()) {
+    return Status(INVALID_ARGUMENT, "The FtdiMpsse driver does not support lockstep programming");
+  }
+  if (pins_.PGC != "TxD" || pins_.PGD != "RxD" ||
+      (!pins_.PGD_in.empty() && pins_.PGD_in != "RTS")) {
+    return Status(INVALID_ARGUMENT,
+                  "The FtdiMpsse driver requires PGC on TxD, PGD on RxD and the PGD input on RTS");
+  }
+  if (usb_open_) {
+    return Reopen();
+  }
+  RETURN_IF_ERROR(OpenFtdiDevice(&ftdic_, selector_, {0x6014, 0x6010, 0x6011}));
+  if (ftdic_.type != TYPE_232H && ftdic_.type != TYPE_2232H && ftdic_.type != TYPE_4232H) {
+    AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
+    return Status(INIT_FAILED, "The FtdiMpsse driver requires an FT232H, FT2232H or FT4232H");
+  }
+  if (ftdic_.type == TYPE_4232H && ftdic_.interface > 1) {
+    AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
+    return Status(INIT_FAILED, "MPSSE is only available on interfaces A and B of the FT4232H");
+  }
+
+  memset(translate_pins_, 0, sizeof(translate_pins_));
+  translate_pins_[nMCLR] = pins_.nMCLR == "NC" ? 0 : FtdiPinNameToValue(pins_.nMCLR);
+  translate_pins_[PGM] = pins_.PGM == "NC" ? 0 : FtdiPinNameToValue(pins_.PGM);
+  if ((translate_pins_[nMCLR] | translate_pins_[PGM]) & (kTck | kTdi | kTdo)) {
+    AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
+    return Status(INVALID_ARGUMENT, "TxD, RxD and RTS can not be used for nMCLR or PGM");
+  }
+  translate_pins_[PGC] = kTck;
+  translate_pins_[PGD_out] = kTdi;
+  for (int i = 0; i < 32; ++i) {
+    for (int j : {nMCLR, PGC, PGD_out, PGM}) {
+      if (i & j) {
+        translate_pins_[i] |= translate_pins_[j];
+      }
+    }
+  }
+  pin_directions_ = translate_pins_[nMCLR | PGC | PGD_out | PGM];
+
+  if (ftdi_set_bitmode(&ftdic_, 0, BITMODE_RESET) < 0 ||
+      ftdi_set_bitmode(&ftdic_, 0, BITMODE_MPSSE) < 0) {
+    AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
+    return Status(INIT_FAILED,
+                  strings::Cat("Couldn't set MPSSE mode: ", ftdi_get_error_string(&ftdic_)));
+  }
+  if (ftdi_usb_purge_buffers(&ftdic_) < 0) {
+    AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
+    return Status(Code::INIT_FAILED,
+                  strings::Cat("Could not purge USB buffers: ", ftdi_get_error_string(&ftdic_)));
+  }
+  ftdi_set_latency_timer(&ftdic_, 1);
+
+  Status status = SetupMpsse();
+  if (!status.ok()) {
+    ftdi_deinit(&ftdic_);
+    return status;
+  }
+  usb_open_ = true;
+  open_ = true;
+  return Status::OK;
+}
+
+Status FtdiMpsseDriver::Reopen() {
+  WaitForReset();
+  output_buffer_.clear();
+  if (ftdi_usb_purge_buffers(&ftdic_) < 0) {
+    return Status(Code::INIT_FAILED,
+                  strings::Cat("Could not purge USB buffers: ", ftdi_get_error_string(&ftdic_)));
+  }
+  RETURN_IF_ERROR(SetupMpsse());
+  open_ = true;
+  return Status::OK;
+}
+
+Status FtdiMpsseDriver::SetupMpsse() {
+  // With the divide-by-5 disabled, the clock is 60MHz / ((1 + divisor) * 2).
+  int clock_khz = std::max(1, FLAGS_ftdi_mpsse_clock_khz);
+  int divisor = std::min(std::max((30000 + clock_khz - 1) / clock_khz - 1, 0), 0xffff);
+  Datastring setup{DIS_DIV_5,
+                   DIS_ADAPTIVE,
+                   DIS_3_PHASE,
+                   LOOPBACK_END,
+                   TCK_DIVISOR,
+                   static_cast<uint8_t>(divisor & 0xff),
+                   static_cast<uint8_t>(divisor >> 8),
+                   SET_BITS_LOW,
+                   0,
+                   pin_directions_};
+  last_pins_ = 0;
+  return WriteCommands(setup);
+}
+
+void FtdiMpsseDriver::Close() {
+  if (open_) {
+    SetPins(0).IgnoreResult();
+    FlushOutput().IgnoreResult();
+    release_time_ = std::chrono::steady_clock::now();
+    open_ = false;
+  }
+  if (!usb_open_ || keep_open_) return;
+  WaitForReset();
+  // Turn all pins into inputs
+  WriteCommands(Datastring{SET_BITS_LOW, 0, 0}).IgnoreResult();
+  ftdi_deinit(&ftdic_);
+  usb_open_ = false;
+}
+
+void FtdiMpsseDriver::WaitForReset() {
+  Duration elapsed = std::chrono::steady_clock::now() - release_time_;
+  if (elapsed < kResetTime) {
+    Sleep(kResetTime - elapsed);
+  }
+}
+
+Status FtdiMpsseDriver::List(std::vector<std::string> *list) const {
+  return ListFtdiDevices(list);
+}
+
+Status FtdiMpsseDriver::SetPins(uint8_t pins) {
+  output_buffer_ += pins;
+  return Status::OK;
+}
+
+Status FtdiMpsseDriver::FlushOutput() {
+  if (output_buffer_.empty()) {
+    return Status::OK;
+  }
+  Datastring commands;
+  CompileSequence(output_buffer_, &commands, nullptr, nullptr);
+  output_buffer_.clear();
+  // Reading back the pin state ensures that all commands have been executed by the device when
+  // this function returns. This is required for the timing of the sequences.
+  commands.push_back(GET_BITS_LOW);
+  commands.push_back(SEND_IMMEDIATE);
+  RETURN_IF_ERROR(WriteCommands(commands));
+  Datastring pins;
+  return ReadBytes(1, &pins);
+}
+
+Status FtdiMpsseDriver::ReadWithSequence(const Datastring &sequence,
+                                         const std::vector<int> &bit_offsets, int bit_count,
+                                         uint32_t count, Datastring16 *result, bool lsb_first) {
+  result->clear();
+  // Any pending output is sent in the same write as the read sequence.
+  Datastring commands;
+  CompileSequence(output_buffer_, &commands, nullptr, nullptr);
+  output_buffer_.clear();
+
+  Datastring read_sequence;
+  read_sequence.reserve(sequence.size() * count);
+  for (uint32_t i = 0; i < count; ++i) {
+    read_sequence += sequence;
+  }
+  std::vector<int> sample_bits;
+  int read_size;
+  CompileSequence(read_sequence, &commands, &sample_bits, &read_size);
+  commands.push_back(SEND_IMMEDIATE);
+  RETURN_IF_ERROR(WriteCommands(commands));
+
+  Datastring received_data;
+  RETURN_IF_ERROR(ReadBytes(read_size, &received_data));
+  if (will_print(9)) {
+    print_msg(9, "Got bytes");
+    for (uint8_t datum : received_data) {
+      print_msg(9, " %02X", datum);
+    }
+    print_msg(9, "\n");
+  }
+
+  BitStreamWrapper bit_stream(&received_data);
+  for (uint32_t i = 0; i < count; ++i) {
+    for (int bit_offset : bit_offsets) {
+      uint16_t datum = 0;
+      for (int j = 0; j < bit_count; ++j) {
+        int sample_bit = sample_bits[i * sequence.size() + (bit_offset + j) * 2 + 1];
+        if (sample_bit < 0) {
+          return Status(INVALID_ARGUMENT, "Read sequence does not clock the bits to be read");
+        }
+        if (lsb_first) {
+          datum |= bit_stream.GetBit(sample_bit) << j;
+        } else {
+          datum <<= 1;
+          datum |= bit_stream.GetBit(sample_bit);
+        }
+      }
+      *result += datum;
+    }
+  }
+  return Status::OK;
+}
+
+void FtdiMpsseDriver::CompileSequence(const Datastring &sequence, Datastring *commands,
+                                      std::vector<int> *sample_bits, int *read_size) {
+  if (sample_bits) {
+    sample_bits->assign(sequence.size(), -1);
+    *read_size = 0;
+  }
+
+  size_t idx = 0;
+  while (idx < sequence.size()) {
+    const ClockMode mode = GetClockMode(sequence, idx);
+    if (mode == NO_CLOCK) {
+      AddSetPinsCommand(sequence[idx], commands);
+      ++idx;
+      continue;
+    }
+
+    // The clock data commands require PGC to be low at the start, and the pins not controlled by
+    // the MPSSE engine to be set to their final value.
+    const uint8_t base = sequence[idx] & ~(PGC | PGD_out);
+    if ((last_pins_ & ~PGD_out) != base) {
+      AddSetPinsCommand(base, commands);
+    }
+
+    Datastring data;
+    size_t bits = 0;
+    while (GetClockMode(sequence, idx) == mode && (sequence[idx] & ~(PGC | PGD_out)) == base) {
+      if (bits % 8 == 0) {
+        data.push_back(0);
+      }
+      if (sequence[idx] & PGD_out) {
+        data.back() |= 1 << (bits % 8);
+      }
+      if (sample_bits) {
+        (*sample_bits)[idx + 1] = *read_size * 8 + bits;
+      }
+      ++bits;
+      idx += 2;
+    }
+    last_pins_ = base | (sequence[idx - 2] & PGD_out);
+
+    uint8_t opcode = MPSSE_DO_WRITE | MPSSE_LSB;
+    if (mode == CLOCK_DOWN_UP) {
+      opcode |= MPSSE_WRITE_NEG;
+    }
+    if (sample_bits) {
+      opcode |= MPSSE_DO_READ;
+      if (mode == CLOCK_UP_DOWN) {
+        opcode |= MPSSE_READ_NEG;
+      }
+    }
+    const size_t full_bytes = bits / 8;
+    for (size_t offset = 0; offset < full_bytes; offset += kMaxClockBytes) {
+      size_t length = std::min(kMaxClockBytes, full_bytes - offset);
+      commands->push_back(opcode);
+      commands->push_back((length - 1) & 0xff);
+      commands->push_back((length - 1) >> 8);
+      commands->append(data, offset, length);
+    }
+    const size_t remaining_bits = bits % 8;
+    if (remaining_bits != 0) {
+      commands->push_back(opcode | MPSSE_BITMODE);
+      commands->push_back(remaining_bits - 1);
+      commands->push_back(data.back());
+      if (sample_bits) {
+        // Bits clocked in with a bit command end up in the top bits of the returned byte.
+        for (size_t i = 0; i < remaining_bits; ++i) {
+          (*sample_bits)[idx - 2 * (remaining_bits - i) + 1] += 8 - remaining_bits;
+        }
+      }
+    }
+    if (sample_bits) {
+      *read_size += full_bytes + (remaining_bits != 0 ? 1 : 0);
+    }
+  }
+}
+
+void FtdiMpsseDriver::AddSetPinsCommand(uint8_t pins, Datastring *commands) {
+  if (pins == last_pins_) {
+    return;
+  }
+  commands->push_back(SET_BITS_LOW);
+  commands->push_back(translate_pins_[pins & 0x1f]);
+  commands->push_back(pin_directions_);
+  last_pins_ = pins;
+}
+
+Status FtdiMpsseDriver::WriteCommands(const Datastring &commands) {
+  if (will_print(10)) {
+    for (uint8_t datum : commands) {
+      print_msg(10, "%s ", HexByte(datum).c_str());
+    }
+  }
+  if (ftdi_write_data(&ftdic_, commands.data(), commands.size()) < 0) {
+    return Status(Code::USB_WRITE_ERROR,
+                  strings::Cat("Write failed: ", ftdi_get_error_string(&ftdic_)));
+  }
+  return Status::OK;
+}
+
+Status FtdiMpsseDriver::ReadBytes(int expected_size, Datastring *result) {
+  result->resize(expected_size);
+  // The transfer only completes when all bytes have been received, or the USB read timeout
+  // expires. This avoids polling while long read sequences are clocked out.
+  ftdi_transfer_control *control = ftdi_read_data_submit(&ftdic_, &(*result)[0], expected_size);
+  if (control == nullptr) {
+    return Status(Code::SYNC_LOST, strings::Cat("Read failed: ", ftdi_get_error_string(&ftdic_)));
+  }
+  int bytes_read = ftdi_transfer_data_done(control);
+  if (bytes_read < expected_size) {
+    return Status(Code::SYNC_LOST,
+                  strings::Cat("Did not receive the expected number of bytes (",
+                               std::max(bytes_read, 0), " instead of ", expected_size, ")"));
+  }
+  return Status::OK;
+}
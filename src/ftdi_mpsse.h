@@ -0,0 +1,87 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FTDI_MPSSE_H_
+#define FTDI_MPSSE_H_
+
+#include <chrono>
+#include <libftdi1/ftdi.h>
+
+#include "driver.h"
+#include "ftdi_common.h"
+
+// Class implementing the driver functionality using the MPSSE engine of the H-series FTDI devices
+// (FT232H, FT2232H and FT4232H). The pin sequences generated by the controllers are translated
+// into MPSSE commands, such that the clocked bits are shifted out (and in) by the clock generator
+// of the FTDI chip, instead of requiring two bytes per bit as in bitbang mode. The MPSSE engine
+// requires PGC on TxD (TCK), PGD on RxD (TDI) and the PGD input on RTS (TDO).
+class FtdiMpsseDriver : public Driver {
+ public:
+  FtdiMpsseDriver(const FtdiDeviceSelector &selector, const FtdiPins &pins)
+      : selector_(selector), pins_(pins) {}
+  ~FtdiMpsseDriver() override {
+    keep_open_ = false;
+    Close();
+  }
+
+  Status Open() override;
+  void Close() override;
+  Status List(std::vector<std::string> *list) const override;
+
+  Status ReadWithSequence(const Datastring &sequence, const std::vector<int> &bit_offsets,
+                          int bit_count, uint32_t count, Datastring16 *result,
+                          bool lsb_first) override;
+
+ protected:
+  Status SetPins(uint8_t pins) override;
+  Status FlushOutput() override;
+
+ private:
+  // Translates the pin states in sequence to MPSSE commands, which are appended to commands. Runs
+  // of clock pulses are converted to clock data commands, all other pin states are set using the
+  // GPIO commands. If sample_bits is not nullptr, the clock data commands also read the PGD input.
+  // In that case, for each index in sequence at which the bitbang driver would sample PGD, the
+  // position of the bit in the data returned by the device is stored in sample_bits (or -1 if
+  // the pin is not sampled at that point), and the number of bytes returned by the device is
+  // stored in read_size.
+  void CompileSequence(const Datastring &sequence, Datastring *commands,
+                       std::vector<int> *sample_bits, int *read_size);
+  void AddSetPinsCommand(uint8_t pins, Datastring *commands);
+  // Sends the clock and pin setup commands, with all pins low.
+  Status SetupMpsse();
+  // Prepares the device for a new session after Close left the programmer open.
+  Status Reopen();
+  // Waits until the pins have been held low long enough since the last Close to reset the target.
+  void WaitForReset();
+  Status WriteCommands(const Datastring &commands);
+  Status ReadBytes(int expected_size, Datastring *result);
+
+  const FtdiDeviceSelector selector_;
+  const FtdiPins pins_;
+  uint8_t translate_pins_[32];
+  uint8_t pin_directions_ = 0;
+  uint8_t last_pins_ = 0;
+  ftdi_context ftdic_;
+  bool open_ = false;
+  // Whether the USB device is open. This may be the case while open_ is false if keep_open_ is set.
+  bool usb_open_ = false;
+  std::chrono::steady_clock::time_point release_time_;
+  Datastring output_buffer_;
+};
+
+// Returns the default pins for the FtdiMpsse driver.
+FtdiPins FtdiMpsseDefaultPins();
+// Returns the pins for the FtdiMpsse driver described by the --ftdi_mpsse_* flags.
+FtdiPins FtdiMpssePinsFromFlags();
+
+#endif
@@ -13,55 +13,108 @@
 */
 #include "ftdi_sb.h"
 
+#include <cstring>
+#include <deque>
 #include <gflags/gflags.h>
 
+#include "ftdi_common.h"
 #include "status.h"
 #include "strings.h"
 
-DEFINE_string(ftdi_nMCLR, "TxD", "Pin to use for inverted MCLR.");
-DEFINE_string(ftdi_PGC, "DTR", "Pin to use for PGC");
-DEFINE_string(ftdi_PGD_in, "", "Pin to use for PGD input if using split input");
-DEFINE_string(ftdi_PGD, "RxD", "Pin to use for PGD");
-DEFINE_string(ftdi_PGM, "CTS", "Pin to use for PGM");
-DEFINE_int32(ftdi_vendor_id, 0, "Vendor ID of the device to open. Defaults to FTDI vendor ID.");
-DEFINE_int32(ftdi_product_id, 0, "Product ID of the device to open. Defaults to FT232 product ID.");
-DEFINE_string(ftdi_description, "", "Product description to select which FTDI device to use.");
-DEFINE_string(ftdi_serial, "", "Serial number to select which FTDI device to use.");
-DEFINE_string(ftdi_program_interface, "A",
-              "Interface to use on the FTDI device, for devices which have multiple interfaces "
-              "(e.g. FT4232H). Possible values are A, B, C, or D.");
+DEFINE_int32(ftdi_max_stream_delay_us, 0,
+             "Longest delay in microseconds to time by sending idle bytes to the device with the "
+             "FtdiSb driver, instead of waiting on the host. Set to 0 to disable.");
+DEFINE_int32(ftdi_async_threshold, 4096,
+             "Minimum number of bytes to write at once for the FtdiSb driver to switch to "
+             "asynchronous bitbang mode, which does not read back every byte written. Set to 0 "
+             "to disable.");
+DEFINE_int32(ftdi_queue_depth, 3,
+             "Number of USB write transfers to keep in flight with the FtdiSb driver. Higher "
+             "values keep the USB bus busy, at the cost of smaller transfers.");
 
-FtdiSbDriver::Pin FtdiSbDriver::pins_[] = {
-    {"TxD", 0}, {"RxD", 1}, {"RTS", 2}, {"CTS", 3}, {"DTR", 4}, {"DSR", 5}, {"DCD", 6}, {"RI", 7},
+DEFINE_int32(ftdi_baud_rate, 0,
+             "Baud rate determining the bitbang clock of the FtdiSb driver. Defaults to a value "
+             "depending on the type of FTDI chip.");
+DEFINE_int32(ftdi_chunk_size, 0,
+             "Maximum number of bytes the FtdiSb driver writes before the bytes sent back by the "
+             "device are read. Defaults to a value depending on the type of FTDI chip.");
+DEFINE_int32(ftdi_latency_timer, 0,
+             "Latency timer value in milliseconds for the FtdiSb driver. Defaults to a value "
+             "depending on the type of FTDI chip.");
+DEFINE_int32(ftdi_usb_chunk_size, 0,
+             "Size of the USB transfers used by libftdi for the FtdiSb driver. Defaults to a value "
+             "depending on the type of FTDI chip.");
+
+namespace {
+
+constexpr size_t kOutputBufferSize = 65536;
+// In asynchronous bitbang mode there is no receive budget, so larger transfers can be used.
+constexpr size_t kAsyncChunkSize = 4096;
+
+struct ChipParameters {
+  int baud_rate;
+  // Maximum number of bytes written but not yet read back in synchronous mode.
+  size_t receive_budget;
+  // Size of the FIFO holding the bytes written to the device.
+  int fifo_size;
+  int latency_timer;
+  int usb_chunk_size;
 };
 
+const ChipParameters &GetChipParameters(ftdi_chip_type type) {
+  // Setting the baud rate to higher values than 1'000'000 does not seem to yield faster data
+  // transfers on the full speed devices. This is probably due to the round-tripping that has to be
+  // done for the reads, and the limited size of the receive buffer. Receive budget values larger
+  // than 384 don't work, at least for the FT232RL. Likely they cause a receive buffer overflow in
+  // the FTDI chip.
+  static const ChipParameters full_speed = {1000000, 384, 256, 1, 4096};
+  // The high speed devices have larger buffers, which are split between the interfaces.
+  static const ChipParameters ft2232h = {2000000, 2048, 4096, 1, 16384};
+  static const ChipParameters ft4232h = {2000000, 1024, 2048, 1, 16384};
+  static const ChipParameters ft232h = {2000000, 512, 1024, 1, 16384};
+  switch (type) {
+    case TYPE_2232H:
+      return ft2232h;
+    case TYPE_4232H:
+      return ft4232h;
+    case TYPE_232H:
+      return ft232h;
+    default:
+      return full_speed;
+  }
+}
+
+// In synchronous bitbang mode, the pins are updated at most once per clock tick of 16 times the
+// baud rate.
+constexpr int kBytesPerBaud = 16;
+// Time for which all pins are held low when closing, to ensure the target is reset.
+constexpr Duration kResetTime = MilliSeconds(100);
+
+}  // namespace
+
+FtdiSbDriver::FtdiSbDriver(const FtdiDeviceSelector &selector, const FtdiPins &pins)
+    : selector_(selector), pins_(pins), output_buffer_(kOutputBufferSize) {}
+
 Status FtdiSbDriver::Open() {
   if (open_) return Status(INIT_FAILED, "Device already open");
-  if (ftdi_init(&ftdic_) < 0) {
-    return Status(Code::INIT_FAILED, strings::Cat("Couldn't initialize ftdi_context struct: ",
-                                                  ftdi_get_error_string(&ftdic_)));
-  }
-  if (FLAGS_ftdi_program_interface.size() != 1 || FLAGS_ftdi_program_interface[0] < 'A' ||
-      FLAGS_ftdi_program_interface[0] > 'D') {
-    return Status(Code::INVALID_ARGUMENT,
-                  strings::Cat("Invalid interface '", FLAGS_ftdi_program_interface, "' specified"));
+  if (usb_open_) {
+    return Reopen();
   }
-  if (ftdi_set_interface(
-          &ftdic_, static_cast<ftdi_interface>(FLAGS_ftdi_program_interface[0] - 'A' + 1)) < 0) {
-    return Status(Code::INIT_FAILED,
-                  strings::Cat("Couldn't set FTDI interface: ", ftdi_get_error_string(&ftdic_)));
-  }
-  if (ftdi_usb_open_desc(&ftdic_, FLAGS_ftdi_vendor_id == 0 ? 0x0403 : FLAGS_ftdi_vendor_id,
-                         FLAGS_ftdi_product_id == 0 ? 0x6001 : FLAGS_ftdi_product_id,
-                         FLAGS_ftdi_description.empty() ? nullptr : FLAGS_ftdi_description.c_str(),
-                         FLAGS_ftdi_serial.empty() ? nullptr : FLAGS_ftdi_serial.c_str()) < 0) {
+  RETURN_IF_ERROR(OpenFtdiDevice(&ftdic_, selector_, {0x6001, 0x6010, 0x6011, 0x6014, 0x6015}));
+  const ChipParameters &parameters = GetChipParameters(ftdic_.type);
+  baud_rate_ = FLAGS_ftdi_baud_rate > 0 ? FLAGS_ftdi_baud_rate : parameters.baud_rate;
+  receive_budget_ = FLAGS_ftdi_chunk_size > 0 ? FLAGS_ftdi_chunk_size : parameters.receive_budget;
+  fifo_size_ = parameters.fifo_size;
+  discard_buffer_.resize(receive_budget_);
+  usb_chunk_size_ =
+      FLAGS_ftdi_usb_chunk_size > 0 ? FLAGS_ftdi_usb_chunk_size : parameters.usb_chunk_size;
+  if (ftdi_read_data_set_chunksize(&ftdic_, usb_chunk_size_) < 0 ||
+      ftdi_write_data_set_chunksize(&ftdic_, usb_chunk_size_) < 0) {
+    AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
     return Status(Code::INIT_FAILED,
-                  strings::Cat("Couldn't open FTDI device: ", ftdi_get_error_string(&ftdic_)));
+                  strings::Cat("Couldn't set chunk size: ", ftdi_get_error_string(&ftdic_)));
   }
-  // Setting this to higher values than 1'000'000 does not seem to yield faster data transfers. This
-  // is probably due to the round-tripping that has to be done for the reads, and the limited size
-  // of the receive buffer.
-  if (ftdi_set_baudrate(&ftdic_, 1000000)) {
+  if (ftdi_set_baudrate(&ftdic_, baud_rate_)) {
     AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
     return Status(Code::INIT_FAILED,
                   strings::Cat("Couldn't set baud rate: ", ftdi_get_error_string(&ftdic_)));
@@ -72,12 +125,25 @@ Status FtdiSbDriver::Open() {
                   strings::Cat("Could not purge USB buffers: ", ftdi_get_error_string(&ftdic_)));
   }
   memset(translate_pins_, 0, sizeof(translate_pins_));
-  translate_pins_[nMCLR] = FLAGS_ftdi_nMCLR == "NC" ? 0 : PinNameToValue(FLAGS_ftdi_nMCLR);
-  translate_pins_[PGC] = PinNameToValue(FLAGS_ftdi_PGC);
-  translate_pins_[PGD_in] =
-      PinNameToValue(FLAGS_ftdi_PGD_in.empty() ? FLAGS_ftdi_PGD : FLAGS_ftdi_PGD_in);
-  translate_pins_[PGD_out] = PinNameToValue(FLAGS_ftdi_PGD);
-  translate_pins_[PGM] = FLAGS_ftdi_PGM == "NC" ? 0 : PinNameToValue(FLAGS_ftdi_PGM);
+  translate_pins_[nMCLR] = pins_.nMCLR == "NC" ? 0 : FtdiPinNameToValue(pins_.nMCLR);
+  translate_pins_[PGC] = FtdiPinNameToValue(pins_.PGC);
+  translate_pins_[PGD_in] = FtdiPinNameToValue(pins_.PGD_in.empty() ? pins_.PGD : pins_.PGD_in);
+  translate_pins_[PGD_out] = FtdiPinNameToValue(pins_.PGD);
+  translate_pins_[PGM] = pins_.PGM == "NC" ? 0 : FtdiPinNameToValue(pins_.PGM);
+  // The PGD pins of the lockstep targets receive the same output as the primary PGD pin.
+  lockstep_pins_.clear();
+  uint8_t used_pins = translate_pins_[nMCLR] | translate_pins_[PGC] | translate_pins_[PGD_in] |
+                      translate_pins_[PGD_out] | translate_pins_[PGM];
+  for (const std::string &name : strings::Split<std::string>(pins_.lockstep_PGD, ',', false)) {
+    uint8_t pin = FtdiPinNameToValue(name);
+    if (used_pins & pin) {
+      AutoClosureRunner deinit([this] { ftdi_deinit(&ftdic_); });
+      return Status(INVALID_ARGUMENT, strings::Cat("Pin ", name, " is used more than once"));
+    }
+    used_pins |= pin;
+    lockstep_pins_.push_back(pin);
+    translate_pins_[PGD_out] |= pin;
+  }
   for (int i = 0; i < 16; ++i) {
     for (int j : {nMCLR, PGC, PGD_in, PGD_out, PGM}) {
       if (i & j) {
@@ -90,190 +156,323 @@ Status FtdiSbDriver::Open() {
     return Status(INIT_FAILED,
                   strings::Cat("Couldn't set bitbang mode: ", ftdi_get_error_string(&ftdic_)));
   }
-  ftdi_set_latency_timer(&ftdic_, 1);
+  ftdi_set_latency_timer(
+      &ftdic_, FLAGS_ftdi_latency_timer > 0 ? FLAGS_ftdi_latency_timer : parameters.latency_timer);
+  async_mode_ = false;
+  usb_open_ = true;
+  open_ = true;
+  return Status::OK;
+}
+
+Status FtdiSbDriver::Reopen() {
+  WaitForReset();
+  output_buffer_.Clear();
+  if (ftdi_usb_purge_buffers(&ftdic_) < 0) {
+    return Status(Code::INIT_FAILED,
+                  strings::Cat("Could not purge USB buffers: ", ftdi_get_error_string(&ftdic_)));
+  }
+  if (ftdi_set_bitmode(&ftdic_, translate_pins_[nMCLR | PGC | PGD_out | PGM], BITMODE_SYNCBB) < 0) {
+    return Status(INIT_FAILED,
+                  strings::Cat("Couldn't set bitbang mode: ", ftdi_get_error_string(&ftdic_)));
+  }
+  async_mode_ = false;
   open_ = true;
   return Status::OK;
 }
 
 void FtdiSbDriver::Close() {
-  if (!open_) return;
-  SetPins(0).IgnoreResult();
-  FlushOutput().IgnoreResult();
-  Sleep(MilliSeconds(100));
+  if (open_) {
+    SetPins(0).IgnoreResult();
+    FlushOutput().IgnoreResult();
+    release_time_ = std::chrono::steady_clock::now();
+    open_ = false;
+  }
+  if (!usb_open_ || keep_open_) return;
+  WaitForReset();
   // Turn all pins into inputs
   ftdi_set_bitmode(&ftdic_, 0, BITMODE_SYNCBB);
   ftdi_deinit(&ftdic_);
-  open_ = false;
+  usb_open_ = false;
+}
+
+void FtdiSbDriver::WaitForReset() {
+  Duration elapsed = std::chrono::steady_clock::now() - release_time_;
+  if (elapsed < kResetTime) {
+    Sleep(kResetTime - elapsed);
+  }
 }
 
 Status FtdiSbDriver::List(std::vector<std::string> *list) const {
-  ftdi_context ftdic;
-  if (ftdi_init(&ftdic) < 0) {
-    return Status(Code::INIT_FAILED, strings::Cat("Couldn't initialize ftdi_context struct: ",
-                                                  ftdi_get_error_string(&ftdic)));
-  }
-  ftdi_device_list *device_list = nullptr;
-  int num_devices;
-  int vendor_id = 0x0403;
-  for (int product_id : {0x6001, 0x6010, 0x6011, 0x6014, 0x6015}) {
-    if ((num_devices = ftdi_usb_find_all(&ftdic, &device_list, vendor_id, product_id)) < 0) {
-      return Status(Code::INIT_FAILED,
-                    strings::Cat("Could not list devices: ", ftdi_get_error_string(&ftdic)));
+  return ListFtdiDevices(list);
+}
+
+Status FtdiSbDriver::SetPins(uint8_t pins) {
+  if (output_buffer_.full()) {
+    RETURN_IF_ERROR(FlushOutput());
+  }
+  last_pins_ = translate_pins_[pins];
+  output_buffer_.Append(last_pins_);
+  return Status::OK;
+}
+
+Status FtdiSbDriver::WriteDatastring(const Datastring &data) {
+  size_t idx = 0;
+  while (idx < data.size()) {
+    if (output_buffer_.full()) {
+      RETURN_IF_ERROR(FlushOutput());
     }
-    for (ftdi_device_list *ptr = device_list; ptr != nullptr; ptr = ptr->next) {
-      char description[1024];
-      char serial[1024];
-      if (ftdi_usb_get_strings(&ftdic, ptr->dev, nullptr, 0, description, sizeof(description),
-                               serial, sizeof(serial)) < 0) {
-        return Status(Code::INIT_FAILED, strings::Cat("Error getting device strings: ",
-                                                      ftdi_get_error_string(&ftdic)));
-      }
-      list->push_back(strings::Cat("Vendor ID: 0x", HexUint16(vendor_id), "\nProduct ID: 0x",
-                                   HexUint16(product_id), "\nDescription: ", description,
-                                   "\nSerial: ", serial, "\n"));
+    size_t length;
+    uint8_t *space = output_buffer_.AppendSpace(&length);
+    length = std::min(length, data.size() - idx);
+    for (size_t i = 0; i < length; ++i) {
+      space[i] = translate_pins_[data[idx + i]];
     }
-    ftdi_list_free(&device_list);
+    output_buffer_.Commit(length);
+    idx += length;
+  }
+  if (!data.empty()) {
+    last_pins_ = translate_pins_[data.back()];
   }
   return Status::OK;
 }
 
-Status FtdiSbDriver::SetPins(uint8_t pins) {
-  output_buffer_ += translate_pins_[pins];
+Status FtdiSbDriver::WriteRepeated(const Datastring &data, uint32_t count) {
+  if (data.empty() || count == 0) {
+    return Status::OK;
+  }
+  // Translate only once, and copy the result into the output buffer for each repetition.
+  Datastring translated;
+  for (const uint8_t pins : data) {
+    translated.push_back(translate_pins_[pins]);
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    RETURN_IF_ERROR(AppendTranslated(translated));
+  }
+  last_pins_ = translated.back();
+  return Status::OK;
+}
+
+Status FtdiSbDriver::AppendTranslated(const Datastring &pins) {
+  size_t idx = 0;
+  while (idx < pins.size()) {
+    if (output_buffer_.full()) {
+      RETURN_IF_ERROR(FlushOutput());
+    }
+    size_t length;
+    uint8_t *space = output_buffer_.AppendSpace(&length);
+    length = std::min(length, pins.size() - idx);
+    memcpy(space, pins.data() + idx, length);
+    output_buffer_.Commit(length);
+    idx += length;
+  }
+  return Status::OK;
+}
+
+Status FtdiSbDriver::Delay(Duration duration) {
+  if (duration > MicroSeconds(FLAGS_ftdi_max_stream_delay_us)) {
+    return Driver::Delay(duration);
+  }
+  // The pin state is held by repeating the last byte. The assumed output rate is the maximum the
+  // device can achieve, such that the delay is never shorter than requested.
+  int64_t idle_bytes = (duration.count() * baud_rate_ * kBytesPerBaud + 999999999) / 1000000000;
+  while (idle_bytes > 0) {
+    if (output_buffer_.full()) {
+      RETURN_IF_ERROR(FlushOutput());
+    }
+    size_t length;
+    uint8_t *space = output_buffer_.AppendSpace(&length);
+    length = std::min<int64_t>(length, idle_bytes);
+    memset(space, last_pins_, length);
+    output_buffer_.Commit(length);
+    idle_bytes -= length;
+  }
   return Status::OK;
 }
 
 Status FtdiSbDriver::FlushOutput() {
+  RETURN_IF_ERROR(SelectModeForFlush());
+  // In synchronous mode every byte written results in a byte being read, so the number of bytes
+  // written but not yet read is limited to the receive budget. It is divided over the transfers in
+  // flight.
+  const size_t queue_depth = std::min<size_t>(std::max(FLAGS_ftdi_queue_depth, 1), receive_budget_);
+  const size_t chunk_size = async_mode_ ? kAsyncChunkSize : receive_budget_ / queue_depth;
+  std::deque<PendingTransfer> in_flight;
+  // In synchronous mode, a read transfer is kept posted for the bytes sent back by the device
+  // while the writes are in progress.
+  PendingTransfer read = {nullptr, 0};
+  // Number of bytes written for which the bytes sent back have not been read yet, and the number
+  // of those for which no read has been posted yet.
+  size_t unread = 0;
+  size_t unrequested = 0;
   Status status;
-  static constexpr int kDrainLag = 0;
-  int drain_size = -kDrainLag;
-  while (!output_buffer_.empty()) {
-    // Values larger than 384 don't work, at least for the FT232RL. Likely they cause a receive
-    // buffer overflow in the FTDI chip.
-    int size = std::min<int>(384, output_buffer_.size());
-    if (will_print(10)) {
-      for (int i = 0; i < size; ++i) {
-        print_msg(10, "%s ", HexByte(output_buffer_[i]).c_str());
+  Status write_status;
+  size_t offset = 0;
+  // The transfers refer directly to the data in output_buffer_, so it may only be consumed once
+  // they have completed.
+  while (true) {
+    if (offset < output_buffer_.size() && in_flight.size() < queue_depth &&
+        (async_mode_ || unread < receive_budget_)) {
+      size_t size;
+      const uint8_t *data = output_buffer_.Peek(offset, &size);
+      size = std::min(size, chunk_size);
+      if (!async_mode_) {
+        size = std::min(size, receive_budget_ - unread);
       }
+      if (will_print(10)) {
+        for (size_t i = 0; i < size; ++i) {
+          print_msg(10, "%s ", HexByte(data[i]).c_str());
+        }
+      }
+      ftdi_transfer_control *control =
+          ftdi_write_data_submit(&ftdic_, const_cast<uint8_t *>(data), size);
+      if (!control) {
+        write_status = Status(Code::USB_WRITE_ERROR,
+                              strings::Cat("Write failed: ", ftdi_get_error_string(&ftdic_)));
+        break;
+      }
+      in_flight.push_back({control, static_cast<int>(size)});
+      offset += size;
+      if (!async_mode_) {
+        unread += size;
+        unrequested += size;
+      }
+    } else if (!read.control && unrequested > 0) {
+      uint8_t *buffer = decoder_ ? decoder_->GetWriteBuffer(unrequested) : &discard_buffer_[0];
+      read.control = ftdi_read_data_submit(&ftdic_, buffer, unrequested);
+      if (!read.control) {
+        write_status = Status(Code::SYNC_LOST,
+                              strings::Cat("Read failed: ", ftdi_get_error_string(&ftdic_)));
+        break;
+      }
+      read.size = unrequested;
+      unrequested = 0;
+    } else if (read.control && in_flight.size() < queue_depth) {
+      // No more writes can be submitted until the posted read has completed.
+      status.Update(FinishRead(read));
+      unread -= read.size;
+      read.control = nullptr;
+    } else if (!in_flight.empty()) {
+      PendingTransfer transfer = in_flight.front();
+      in_flight.pop_front();
+      if (ftdi_transfer_data_done(transfer.control) < 0) {
+        write_status = Status(Code::USB_WRITE_ERROR,
+                              strings::Cat("Write failed: ", ftdi_get_error_string(&ftdic_)));
+        break;
+      }
+      output_buffer_.Consume(transfer.size);
+      offset -= transfer.size;
+    } else {
+      break;
     }
-    ftdi_transfer_control *control =
-        ftdi_write_data_submit(&ftdic_, const_cast<uint8_t *>(output_buffer_.data()), size);
-    if (!control) {
-      return Status(Code::USB_WRITE_ERROR,
-                    strings::Cat("Write failed: ", ftdi_get_error_string(&ftdic_)));
-    }
-    output_buffer_.erase(0, size);
-    if (drain_size > 0) {
-      status.Update(DrainInput(drain_size));
-      drain_size = 0;
-    }
-    drain_size += size;
-    if (ftdi_transfer_data_done(control) < 0) {
-      return Status(Code::USB_WRITE_ERROR,
-                    strings::Cat("Write failed: ", ftdi_get_error_string(&ftdic_)));
-    }
   }
-  drain_size += kDrainLag;
-  if (drain_size > 0) {
-    status.Update(DrainInput(drain_size));
+  for (const PendingTransfer &transfer : in_flight) {
+    ftdi_transfer_data_done(transfer.control);
+  }
+  if (read.control) {
+    ftdi_transfer_data_done(read.control);
+  }
+  output_buffer_.Clear();
+  if (!write_status.ok()) {
+    return write_status;
+  }
+  if (async_mode_) {
+    // A completed transfer only means the data is in the FIFO of the device. Wait for the FIFO to
+    // be emptied, such that the output has been applied to the pins when returning.
+    Sleep(FifoDrainTime());
   }
   return status;
 }
 
-uint8_t ReverseBits(uint8_t data) {
-  uint8_t result = 0;
-  for (int i = 0; i < 8; ++i) {
-    if (data & (1 << i)) {
-      result |= (1 << (7 - i));
-    }
+Status FtdiSbDriver::SelectModeForFlush() {
+  // Long runs of output that are not read can use asynchronous bitbang mode, in which the device
+  // does not send back a byte for every byte written.
+  if (!decoder_ && FLAGS_ftdi_async_threshold > 0 &&
+      output_buffer_.size() >= static_cast<size_t>(FLAGS_ftdi_async_threshold)) {
+    return SetAsyncMode(true);
+  }
+  return Status::OK;
+}
+
+Status FtdiSbDriver::SetAsyncMode(bool async) {
+  if (async == async_mode_) {
+    return Status::OK;
+  }
+  if (ftdi_set_bitmode(&ftdic_, translate_pins_[nMCLR | PGC | PGD_out | PGM],
+                       async ? BITMODE_BITBANG : BITMODE_SYNCBB) < 0) {
+    return Status(Code::USB_WRITE_ERROR,
+                  strings::Cat("Couldn't set bitbang mode: ", ftdi_get_error_string(&ftdic_)));
   }
-  return result;
+  // Discard anything received while in asynchronous mode, to ensure that the received bytes line
+  // up with the written bytes.
+  if (!async && ftdi_usb_purge_rx_buffer(&ftdic_) < 0) {
+    return Status(Code::USB_WRITE_ERROR,
+                  strings::Cat("Could not purge USB buffers: ", ftdi_get_error_string(&ftdic_)));
+  }
+  async_mode_ = async;
+  return Status::OK;
+}
+
+Duration FtdiSbDriver::FifoDrainTime() const {
+  // This assumes the slowest output rate, which is one byte per baud.
+  return MicroSeconds((fifo_size_ * INT64_C(1000000) + baud_rate_ - 1) / baud_rate_);
 }
 
 Status FtdiSbDriver::ReadWithSequence(const Datastring &sequence,
                                       const std::vector<int> &bit_offsets, int bit_count,
                                       uint32_t count, Datastring16 *result, bool lsb_first) {
   result->clear();
-  RETURN_IF_ERROR(FlushOutput());
-  received_data_.clear();
-  received_data_.push_back(0);
-  received_data_bit_offset_ = 0;
-  write_mode_ = false;
-  AutoClosureRunner reset_write_mode([this] { write_mode_ = true; });
+  // Pending output is sent in the same stream as the read sequence, unless it is long enough to
+  // be sent in asynchronous mode. The decoder skips the samples taken while writing it.
+  if (FLAGS_ftdi_async_threshold > 0 &&
+      output_buffer_.size() >= static_cast<size_t>(FLAGS_ftdi_async_threshold)) {
+    RETURN_IF_ERROR(FlushOutput());
+  }
+  RETURN_IF_ERROR(SetAsyncMode(false));
+  result->reserve(count * bit_offsets.size());
+  decoder_ = std::make_unique<SampleDecoder>(sequence.size(), bit_offsets, bit_count, lsb_first,
+                                             translate_pins_[PGD_in], output_buffer_.size(),
+                                             result);
+  AutoClosureRunner reset_decoder([this] { decoder_.reset(); });
+  std::vector<Datastring16> lockstep_results(lockstep_pins_.size());
+  for (size_t i = 0; i < lockstep_pins_.size(); ++i) {
+    lockstep_results[i].reserve(count * bit_offsets.size());
+    decoder_->AddTarget(lockstep_pins_[i], &lockstep_results[i]);
+  }
   for (uint32_t i = 0; i < count; ++i) {
     RETURN_IF_ERROR(WriteDatastring(sequence));
   }
   RETURN_IF_ERROR(FlushOutput());
-
-  if (will_print(9)) {
-    print_msg(9, "Got bytes");
-    for (uint8_t datum : received_data_) {
-      print_msg(9, " %02X", datum);
+  for (size_t i = 0; i < lockstep_pins_.size(); ++i) {
+    if (lockstep_results[i] != *result) {
+      return Status(VERIFICATION_ERROR,
+                    strings::Cat("Lockstep target ", i + 2, " returned different data"));
     }
-    print_msg(9, "\n");
   }
 
-  BitStreamWrapper bit_stream(&received_data_);
-  for (uint32_t i = 0; i < count; ++i) {
-    for (int bit_offset : bit_offsets) {
-      uint16_t datum = 0;
-      for (int j = 0; j < bit_count; ++j) {
-        if (lsb_first) {
-          datum |= bit_stream.GetBit(i * sequence.size() + (bit_offset + j) * 2 + 1) << j;
-        } else {
-          datum <<= 1;
-          datum |= bit_stream.GetBit(i * sequence.size() + (bit_offset + j) * 2 + 1);
-        }
-      }
-      *result += datum;
+  if (will_print(9)) {
+    print_msg(9, "Got words");
+    for (uint16_t datum : *result) {
+      print_msg(9, " %04X", datum);
     }
+    print_msg(9, "\n");
   }
   return Status::OK;
 }
 
-uint8_t FtdiSbDriver::PinNameToValue(const std::string &name) {
-  for (const Pin &pin : pins_) {
-    if (name == pin.name) {
-      return (1 << pin.number);
-    }
+Status FtdiSbDriver::FinishRead(const PendingTransfer &read) {
+  int bytes_read = ftdi_transfer_data_done(read.control);
+  if (!decoder_) {
+    // In write mode, we don't really care about the received bytes.
+    return Status::OK;
   }
-  FATAL("No pin named %s available.\n", name.c_str());
-}
-
-Status FtdiSbDriver::DrainInput(int expected_size) {
-  uint8_t buffer[256];
-  int total_bytes_read = 0;
-  int bytes_read;
-  int retries = 0;
-  while (total_bytes_read < expected_size &&
-         (bytes_read = ftdi_read_data(
-              &ftdic_, buffer, std::min<int>(expected_size - total_bytes_read, sizeof(buffer)))) >=
-             0) {
-    if (bytes_read == 0) {
-      if (++retries < 10) {
-        continue;
-      }
-      break;
-    }
-    if (!write_mode_) {
-      for (int i = 0; i < bytes_read; ++i, ++received_data_bit_offset_) {
-        if (received_data_bit_offset_ == 8) {
-          received_data_.push_back(0);
-          received_data_bit_offset_ = 0;
-        }
-        int bit = (buffer[i] & translate_pins_[PGD_in]) ? 1 : 0;
-        bit <<= received_data_bit_offset_;
-        received_data_.back() |= bit;
-      }
-    }
-    total_bytes_read += bytes_read;
+  if (bytes_read > 0) {
+    decoder_->Commit(bytes_read);
   }
-  // In read mode it is vital we receive all the bytes. In write mode, we don't really care.
-  // It appears to be a problem with read bytes not being reported to the USB host, rather
-  // than a complete loss of data.
-  if (total_bytes_read < expected_size && !write_mode_) {
+  // In read mode it is vital we receive all the bytes.
+  if (bytes_read < read.size) {
     return Status(Code::SYNC_LOST,
-                  strings::Cat("Did not receive the expected number of bytes (", total_bytes_read,
-                               " instead of ", expected_size, ")"));
+                  strings::Cat("Did not receive the expected number of bytes (", bytes_read,
+                               " instead of ", read.size, ")"));
   }
   return Status::OK;
 }
@@ -14,15 +14,24 @@
 #ifndef FTDI_SB_H_
 #define FTDI_SB_H_
 
+#include <chrono>
 #include <libftdi1/ftdi.h>
+#include <memory>
 
 #include "driver.h"
+#include "ftdi_common.h"
+#include "ring_buffer.h"
+#include "sample_decoder.h"
 
 // Class implementing the driver functionality using the Synchronous Bitbang mode available on
 // several FTDI devices (FT232R(L) and FT2232).
 class FtdiSbDriver : public Driver {
  public:
-  ~FtdiSbDriver() override { Close(); }
+  FtdiSbDriver(const FtdiDeviceSelector &selector, const FtdiPins &pins);
+  ~FtdiSbDriver() override {
+    keep_open_ = false;
+    Close();
+  }
 
   Status Open() override;
   void Close() override;
@@ -31,29 +40,62 @@ class FtdiSbDriver : public Driver {
   Status ReadWithSequence(const Datastring &sequence, const std::vector<int> &bit_offsets,
                           int bit_count, uint32_t count, Datastring16 *result,
                           bool lsb_first) override;
+  Status WriteDatastring(const Datastring &data) override;
+  Status WriteRepeated(const Datastring &data, uint32_t count) override;
 
  protected:
   Status SetPins(uint8_t pins) override;
   Status FlushOutput() override;
+  Status Delay(Duration duration) override;
+
+  // Switches to asynchronous bitbang mode if the output buffer contains a long run of output that
+  // is not read.
+  Status SelectModeForFlush();
+  // Switches between asynchronous and synchronous bitbang mode.
+  Status SetAsyncMode(bool async);
+  // Returns the time it takes for the device to output the bytes in its FIFO.
+  Duration FifoDrainTime() const;
+
+  const FtdiDeviceSelector selector_;
+  const FtdiPins pins_;
+  ftdi_context ftdic_;
+  bool async_mode_ = false;
+  size_t receive_budget_ = 0;
+  int usb_chunk_size_ = 0;
+  // Pin bytes to be sent to the device. This is flushed automatically when it is full.
+  RingBuffer output_buffer_;
+  // Decoder for the bytes received from the device while reading. If not set, the received bytes
+  // are discarded.
+  std::unique_ptr<SampleDecoder> decoder_;
 
  private:
-  struct Pin {
-    const char *name;
-    int number;
+  struct PendingTransfer {
+    ftdi_transfer_control *control;
+    int size;
   };
 
-  static uint8_t PinNameToValue(const std::string &name);
-  Status DrainInput(int expected_size);
-
-  static Pin pins_[];
+  // Appends the already translated pin states in pins to the output buffer.
+  Status AppendTranslated(const Datastring &pins);
+  // Waits for a posted read transfer to complete, and passes the received bytes to the decoder.
+  Status FinishRead(const PendingTransfer &read);
+  // Prepares the device for a new session after Close left the programmer open.
+  Status Reopen();
+  // Waits until the pins have been held low long enough since the last Close to reset the target.
+  void WaitForReset();
 
   uint8_t translate_pins_[32];
-  ftdi_context ftdic_;
-  bool write_mode_ = true;
+  // PGD pins of the targets programmed in lockstep with the primary target.
+  std::vector<uint8_t> lockstep_pins_;
+  // The last (translated) pin state added to the output buffer.
+  uint8_t last_pins_ = 0;
+  int baud_rate_ = 0;
+  int fifo_size_ = 0;
   bool open_ = false;
-  Datastring output_buffer_;
-  Datastring received_data_;
-  int received_data_bit_offset_ = 0;
+  // Whether the USB device is open. This may be the case while open_ is false if keep_open_ is set.
+  bool usb_open_ = false;
+  std::chrono::steady_clock::time_point release_time_;
+  // Buffer for the received bytes when not reading.
+  Datastring discard_buffer_;
 };
 
 #endif
@@ -0,0 +1,293 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "ftdi_usb.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <gflags/gflags.h>
+
+#include "status.h"
+#include "strings.h"
+
+DEFINE_int32(ftdi_usb_transfers, 4,
+             "Number of USB transfers in each direction to keep in flight with the FtdiUsb "
+             "driver.");
+
+namespace {
+
+constexpr unsigned int kTransferTimeoutMs = 5000;
+// Each packet received from an FTDI device starts with two modem status bytes.
+constexpr int kStatusBytes = 2;
+// Maximum time to wait for any transfer to complete before giving up.
+constexpr std::chrono::milliseconds kProgressTimeout(1000);
+
+}  // namespace
+
+Status FtdiUsbDriver::Open() {
+  if (transfers_lost_) {
+    return Status(Code::INIT_FAILED, "USB transfers of a previous session could not be cancelled");
+  }
+  RETURN_IF_ERROR(FtdiSbDriver::Open());
+  // When the programmer was kept open, the transfers are still available.
+  if (!write_transfers_.empty()) {
+    return Status::OK;
+  }
+  const size_t count = std::max(FLAGS_ftdi_usb_transfers, 1);
+  // Read transfers must be a multiple of the packet size, or the device may overflow them.
+  const int packet_size = ftdic_.max_packet_size;
+  const size_t read_size = (usb_chunk_size_ + packet_size - 1) / packet_size * packet_size;
+  write_transfers_.resize(count);
+  read_transfers_.resize(count);
+  for (std::vector<Transfer> *pool : {&write_transfers_, &read_transfers_}) {
+    for (Transfer &transfer : *pool) {
+      transfer.transfer = libusb_alloc_transfer(0);
+      if (!transfer.transfer) {
+        FreeTransfers();
+        Close();
+        return Status(Code::INIT_FAILED, "Couldn't allocate USB transfers");
+      }
+    }
+  }
+  for (Transfer &transfer : read_transfers_) {
+    transfer.buffer.resize(read_size);
+  }
+  return Status::OK;
+}
+
+void FtdiUsbDriver::Close() {
+  FtdiSbDriver::Close();
+  if (!keep_open_) {
+    FreeTransfers();
+  }
+}
+
+Status FtdiUsbDriver::FlushOutput() {
+  if (transfers_lost_) {
+    return Status(Code::USB_WRITE_ERROR, "USB transfers could not be cancelled");
+  }
+  if (write_transfers_.empty() || read_transfers_.empty()) {
+    return FtdiSbDriver::FlushOutput();
+  }
+  RETURN_IF_ERROR(SelectModeForFlush());
+  const size_t chunk_size =
+      async_mode_ ? usb_chunk_size_
+                  : std::max<size_t>(receive_budget_ / write_transfers_.size(), 1);
+
+  std::vector<Transfer *> free_writes;
+  for (Transfer &transfer : write_transfers_) {
+    free_writes.push_back(&transfer);
+  }
+  std::vector<Transfer *> free_reads;
+  for (Transfer &transfer : read_transfers_) {
+    free_reads.push_back(&transfer);
+  }
+  std::deque<Transfer *> writes;
+  std::deque<Transfer *> reads;
+  // Number of bytes written for which the bytes sent back have not been received yet.
+  size_t unread = 0;
+  size_t offset = 0;
+  Status transfer_status;
+  auto last_progress = std::chrono::steady_clock::now();
+  // The write transfers refer directly to the data in output_buffer_, so it may only be consumed
+  // once they have completed. Transfers on the same endpoint complete in order.
+  while (true) {
+    bool progress = false;
+    while (!writes.empty() && writes.front()->completed) {
+      Transfer *transfer = writes.front();
+      writes.pop_front();
+      free_writes.push_back(transfer);
+      if (transfer->transfer->status != LIBUSB_TRANSFER_COMPLETED ||
+          transfer->transfer->actual_length != transfer->transfer->length) {
+        transfer_status = Status(Code::USB_WRITE_ERROR, "Write failed");
+        break;
+      }
+      output_buffer_.Consume(transfer->transfer->length);
+      offset -= transfer->transfer->length;
+      progress = true;
+    }
+    while (transfer_status.ok() && !reads.empty() && reads.front()->completed) {
+      Transfer *transfer = reads.front();
+      reads.pop_front();
+      free_reads.push_back(transfer);
+      if (transfer->transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        // Even when the received bytes are not needed, the device still holds the bytes that were
+        // not received. Continuing would overrun its buffer, as the receive budget can no longer
+        // be tracked.
+        transfer_status = Status(Code::SYNC_LOST, "Read failed");
+        break;
+      }
+      unread -= std::min(unread, DeliverReceivedData(*transfer));
+      progress = true;
+    }
+    if (!transfer_status.ok()) {
+      break;
+    }
+
+    if (offset < output_buffer_.size() && !free_writes.empty() &&
+        (async_mode_ || unread < receive_budget_)) {
+      size_t size;
+      const uint8_t *data = output_buffer_.Peek(offset, &size);
+      size = std::min(size, chunk_size);
+      if (!async_mode_) {
+        size = std::min(size, receive_budget_ - unread);
+      }
+      if (will_print(10)) {
+        for (size_t i = 0; i < size; ++i) {
+          print_msg(10, "%s ", HexByte(data[i]).c_str());
+        }
+      }
+      Transfer *transfer = free_writes.back();
+      transfer_status =
+          SubmitTransfer(transfer, ftdic_.out_ep, const_cast<uint8_t *>(data), size);
+      if (!transfer_status.ok()) {
+        break;
+      }
+      free_writes.pop_back();
+      writes.push_back(transfer);
+      offset += size;
+      if (!async_mode_) {
+        unread += size;
+      }
+      continue;
+    }
+    if (unread > 0 && !free_reads.empty()) {
+      Transfer *transfer = free_reads.back();
+      transfer_status = SubmitTransfer(transfer, ftdic_.in_ep, &transfer->buffer[0],
+                                       transfer->buffer.size());
+      if (!transfer_status.ok()) {
+        break;
+      }
+      free_reads.pop_back();
+      reads.push_back(transfer);
+      continue;
+    }
+    if (offset == output_buffer_.size() && writes.empty() && unread == 0) {
+      break;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (progress) {
+      last_progress = now;
+    } else if (now - last_progress > kProgressTimeout) {
+      transfer_status = Status(Code::SYNC_LOST, strings::Cat("Timeout waiting for USB transfers (",
+                                                             unread, " bytes not received)"));
+      break;
+    }
+    transfer_status = HandleEvents();
+    if (!transfer_status.ok()) {
+      break;
+    }
+  }
+  Status cancel_status = CancelTransfers(writes);
+  cancel_status.Update(CancelTransfers(reads));
+  if (!cancel_status.ok()) {
+    // The write transfers may still refer to output_buffer_, so it can't be cleared or reused.
+    transfers_lost_ = true;
+    return cancel_status;
+  }
+  output_buffer_.Clear();
+  if (!transfer_status.ok()) {
+    return transfer_status;
+  }
+  if (async_mode_) {
+    // A completed transfer only means the data is in the FIFO of the device. Wait for the FIFO to
+    // be emptied, such that the output has been applied to the pins when returning.
+    Sleep(FifoDrainTime());
+  }
+  return Status::OK;
+}
+
+void LIBUSB_CALL FtdiUsbDriver::TransferCallback(libusb_transfer *transfer) {
+  static_cast<Transfer *>(transfer->user_data)->completed = true;
+}
+
+Status FtdiUsbDriver::SubmitTransfer(Transfer *transfer, uint8_t endpoint, uint8_t *data,
+                                     size_t size) {
+  libusb_fill_bulk_transfer(transfer->transfer, ftdic_.usb_dev, endpoint, data, size,
+                            TransferCallback, transfer, kTransferTimeoutMs);
+  transfer->completed = false;
+  int result = libusb_submit_transfer(transfer->transfer);
+  if (result < 0) {
+    transfer->completed = true;
+    return Status(Code::USB_WRITE_ERROR,
+                  strings::Cat("Couldn't submit USB transfer: ", libusb_error_name(result)));
+  }
+  return Status::OK;
+}
+
+size_t FtdiUsbDriver::DeliverReceivedData(const Transfer &transfer) {
+  const int packet_size = ftdic_.max_packet_size;
+  const int length = transfer.transfer->actual_length;
+  size_t data_size = 0;
+  for (int pos = 0; pos < length; pos += packet_size) {
+    data_size += std::max(std::min(packet_size, length - pos) - kStatusBytes, 0);
+  }
+  // When not reading, the data is not needed at all.
+  if (decoder_ && data_size > 0) {
+    uint8_t *destination = decoder_->GetWriteBuffer(data_size);
+    for (int pos = 0; pos < length; pos += packet_size) {
+      int packet_data_size = std::min(packet_size, length - pos) - kStatusBytes;
+      if (packet_data_size > 0) {
+        memcpy(destination, &transfer.buffer[pos + kStatusBytes], packet_data_size);
+        destination += packet_data_size;
+      }
+    }
+    decoder_->Commit(data_size);
+  }
+  return data_size;
+}
+
+Status FtdiUsbDriver::HandleEvents() {
+  timeval timeout = {0, 100000};
+  int result = libusb_handle_events_timeout_completed(ftdic_.usb_ctx, &timeout, nullptr);
+  if (result < 0) {
+    return Status(Code::USB_WRITE_ERROR,
+                  strings::Cat("Error handling USB events: ", libusb_error_name(result)));
+  }
+  return Status::OK;
+}
+
+Status FtdiUsbDriver::CancelTransfers(const std::deque<Transfer *> &transfers) {
+  for (Transfer *transfer : transfers) {
+    if (!transfer->completed) {
+      libusb_cancel_transfer(transfer->transfer);
+    }
+  }
+  // Errors from handling events may be transient, so they are retried until the timeout expires.
+  Status status;
+  auto start = std::chrono::steady_clock::now();
+  for (Transfer *transfer : transfers) {
+    while (!transfer->completed) {
+      if (std::chrono::steady_clock::now() - start > kProgressTimeout) {
+        return status.ok() ? Status(Code::USB_WRITE_ERROR, "Timeout cancelling USB transfers")
+                           : status;
+      }
+      status = HandleEvents();
+    }
+  }
+  return Status::OK;
+}
+
+void FtdiUsbDriver::FreeTransfers() {
+  for (std::vector<Transfer> *pool : {&write_transfers_, &read_transfers_}) {
+    for (Transfer &transfer : *pool) {
+      // Transfers that never completed are still owned by libusb, so they are leaked instead.
+      if (transfer.transfer && transfer.completed) {
+        libusb_free_transfer(transfer.transfer);
+      }
+    }
+    pool->clear();
+  }
+}
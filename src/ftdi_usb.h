@@ -0,0 +1,68 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FTDI_USB_H_
+#define FTDI_USB_H_
+
+#include <deque>
+#include <libusb.h>
+#include <vector>
+
+#include "ftdi_sb.h"
+
+// Variant of the FtdiSbDriver which performs the data transfers directly using libusb
+// asynchronous transfers, rather than through libftdi. libftdi is still used for opening and
+// configuring the device. This driver keeps a fixed pool of USB transfers in each direction, and
+// strips the modem status bytes from the received packets while passing the data to the decoder.
+class FtdiUsbDriver : public FtdiSbDriver {
+ public:
+  using FtdiSbDriver::FtdiSbDriver;
+  ~FtdiUsbDriver() override {
+    keep_open_ = false;
+    Close();
+  }
+
+  Status Open() override;
+  void Close() override;
+
+ protected:
+  Status FlushOutput() override;
+
+ private:
+  struct Transfer {
+    libusb_transfer *transfer = nullptr;
+    bool completed = true;
+    // Buffer for the received data. Not used for write transfers.
+    Datastring buffer;
+  };
+
+  static void LIBUSB_CALL TransferCallback(libusb_transfer *transfer);
+
+  Status SubmitTransfer(Transfer *transfer, uint8_t endpoint, uint8_t *data, size_t size);
+  // Passes the data received by a read transfer to the decoder, and returns the number of data
+  // bytes received.
+  size_t DeliverReceivedData(const Transfer &transfer);
+  Status HandleEvents();
+  // Cancels the transfers and waits until all of them have completed. Fails if that takes longer
+  // than the progress timeout.
+  Status CancelTransfers(const std::deque<Transfer *> &transfers);
+  void FreeTransfers();
+
+  std::vector<Transfer> write_transfers_;
+  std::vector<Transfer> read_transfers_;
+  // Set if transfers could not be cancelled. As they may still refer to the output buffer, no
+  // further transfers are made.
+  bool transfers_lost_ = false;
+};
+
+#endif
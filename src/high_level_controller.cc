@@ -13,51 +13,121 @@
 */
 #include "high_level_controller.h"
 
+#include <cerrno>
+#include <cstring>
+
 #include "status.h"
 #include "strings.h"
 
+// Number of rows compared against the device before using the shadow for a range.
+static constexpr size_t kShadowSpotCheckRows = 8;
+
 static void AddFillerBytes(const Datastring filler, uint32_t size, Datastring *bytes) {
   for (uint32_t i = 0; i < size; ++i) {
     bytes->push_back(filler[i % filler.size()]);
   }
 }
 
+// Removes the write blocks below end_address which only contain filler bytes from program,
+// splitting sections where necessary. Returns the number of blocks removed.
+static int RemoveFillerBlocks(const Datastring &filler, uint32_t block_size, uint32_t end_address,
+                              Program *program) {
+  int removed = 0;
+  Program result;
+  for (const auto &section : *program) {
+    if (section.first >= end_address) {
+      result.insert(section);
+      continue;
+    }
+    const Datastring &data = section.second;
+    const uint32_t section_end = section.first + data.size();
+    // Offset of the first byte in data which has not been copied to result yet.
+    size_t pending = 0;
+    for (uint32_t block = (section.first + block_size - 1) / block_size * block_size;
+         block + block_size <= section_end; block += block_size) {
+      const size_t offset = block - section.first;
+      bool only_filler = true;
+      for (uint32_t i = 0; i < block_size && only_filler; ++i) {
+        only_filler = data[offset + i] == filler[(block + i) % filler.size()];
+      }
+      if (!only_filler) {
+        continue;
+      }
+      if (offset > pending) {
+        result[section.first + pending] = data.substr(pending, offset - pending);
+      }
+      pending = offset + block_size;
+      ++removed;
+    }
+    if (pending < data.size()) {
+      result[section.first + pending] = data.substr(pending);
+    }
+  }
+  *program = std::move(result);
+  return removed;
+}
+
 Status HighLevelController::ReadProgram(const std::vector<Section> &sections, Program *program) {
   DeviceCloser closer(this);
   RETURN_IF_ERROR(InitDevice());
   print_msg(1, "Initialized device [%s]\n", device_info_.name.c_str());
 
-  std::set<Section> sections_set(sections.begin(), sections.end());
-  if (ContainsKey(sections_set, FLASH)) {
-    print_msg(1, "Reading flash data\n");
-    RETURN_IF_ERROR(ReadData(FLASH, &(*program)[0], 0, device_info_.program_memory_size));
-  }
-  if (ContainsKey(sections_set, USER_ID) && device_info_.user_id_size > 0) {
-    print_msg(1, "Reading user ID data\n");
-    RETURN_IF_ERROR(ReadData(USER_ID, &(*program)[device_info_.user_id_address],
-                             device_info_.user_id_address, device_info_.user_id_size));
-  }
-  if (ContainsKey(sections_set, CONFIGURATION) && device_info_.config_size > 0) {
-    print_msg(1, "Reading configuration data\n");
-    RETURN_IF_ERROR(ReadData(CONFIGURATION, &(*program)[device_info_.config_address],
-                             device_info_.config_address, device_info_.config_size));
-    RemoveMissingConfigBytes(program, device_info_);
-  }
-  if (ContainsKey(sections_set, EEPROM) && device_info_.eeprom_size > 0) {
-    print_msg(1, "Reading EEPROM data\n");
-    RETURN_IF_ERROR(ReadData(EEPROM, &(*program)[device_info_.eeprom_address],
-                             device_info_.eeprom_address, device_info_.eeprom_size));
-  }
+  std::vector<PlannedOperation> operations;
+  auto add_read = [&](Section section, uint32_t address, uint32_t size) {
+    if (size == 0 || std::find(sections.begin(), sections.end(), section) == sections.end()) {
+      return;
+    }
+    operations.push_back({section, address, [this, program, section, address, size](bool *) {
+                            print_msg(1, "Reading %s data\n", SectionToName(section));
+                            return ReadData(section, &(*program)[address], address, size);
+                          }});
+  };
+  add_read(FLASH, 0, device_info_.program_memory_size);
+  add_read(USER_ID, device_info_.user_id_address, device_info_.user_id_size);
+  add_read(CONFIGURATION, device_info_.config_address, device_info_.config_size);
+  add_read(EEPROM, device_info_.eeprom_address, device_info_.eeprom_size);
+  RETURN_IF_ERROR(PerformPlanned(std::move(operations)));
+  RemoveMissingConfigBytes(program, device_info_);
   return Status::OK;
 }
 
 Status HighLevelController::WriteProgram(const std::vector<Section> &sections,
                                          const Program &program, EraseMode erase_mode) {
-  // FIXME: perform row erase, or drop support for row-erase entirely
   std::set<Section> write_sections(sections.begin(), sections.end());
   DeviceCloser closer(this);
   RETURN_IF_ERROR(InitDevice());
   print_msg(1, "Initialized device [%s]\n", device_info_.name.c_str());
+  if (erase_mode == ROW_ERASE) {
+    if (device_info_.row_erase_size == 0) {
+      return Status(UNIMPLEMENTED, strings::Cat("Row erase not supported for device ",
+                                                device_info_.name, " (no row_erase_size)"));
+    }
+    // Only flash can be erased per row, and EEPROM is written without erasing. The user ID and
+    // configuration would need a section erase, which the pic24 and new 8-bit families lack.
+    for (const auto &section : program) {
+      Section type;
+      if (AddressToSection(section.first, &type) && ContainsKey(write_sections, type) &&
+          (type == USER_ID || type == CONFIGURATION)) {
+        return Status(INVALID_ARGUMENT,
+                      strings::Cat("Row erase mode can't write the ", SectionToName(type),
+                                   " section; select only flash and eeprom with --sections"));
+      }
+    }
+  }
+
+  shadow_data_.clear();
+  shadow_known_.clear();
+  if (!shadow_directory_.empty()) {
+    std::string shadow_path;
+    RETURN_IF_ERROR(GetShadowPath(&shadow_path));
+    // Without a key there is no shadow to load, but the written data is still recorded, in case
+    // the program sets the key.
+    LoadShadow(shadow_path);
+    if (!shadow_path.empty()) {
+      // The contents of the device are unknown until the write has been verified.
+      remove(shadow_path.c_str());
+    }
+  }
 
   Program block_aligned_program = program;
 
@@ -69,7 +139,7 @@ Status HighLevelController::WriteProgram(const std::vector<Section> &sections,
     }
     if (last_end != section.first) {
       if (last_end > section.first) {
-        fatal("Program has overlapping sections\n");
+        return Status(INVALID_PROGRAM, "Program has overlapping sections");
       }
       missing_ranges.emplace_back(last_end, section.first);
     }
@@ -79,7 +149,9 @@ Status HighLevelController::WriteProgram(const std::vector<Section> &sections,
     missing_ranges.emplace_back(last_end, device_info_.program_memory_size);
   }
 
-  const uint32_t block_size = device_info_.write_block_size;
+  // In row erase mode, entire rows are erased and rewritten, so the program must cover them.
+  const uint32_t block_size =
+      erase_mode == ROW_ERASE ? device_info_.row_erase_size : device_info_.write_block_size;
   for (const auto &range : missing_ranges) {
     uint32_t lower = ((range.first + block_size - 1) / block_size) * block_size;
     uint32_t higher = (range.second / block_size) * block_size;
@@ -141,15 +213,25 @@ Status HighLevelController::WriteProgram(const std::vector<Section> &sections,
   }
   set_intersect(&erase_sections, write_sections);
 
+  // After erasing, the flash only contains filler bytes. Blocks consisting of only filler bytes
+  // therefore don't have to be written or verified.
+  const bool flash_erased = erase_mode == CHIP_ERASE ||
+                            (erase_mode == SECTION_ERASE && ContainsKey(erase_sections, FLASH));
+  if (flash_erased) {
+    int removed = RemoveFillerBlocks(device_db_->GetBlockFillter(), block_size,
+                                     device_info_.program_memory_size, &block_aligned_program);
+    print_msg(2, "Skipping %d blocks containing only filler bytes\n", removed);
+  }
+
+  RETURN_IF_ERROR(CheckCancelled());
   switch (erase_mode) {
     case CHIP_ERASE:
       print_msg(1, "Starting chip erase\n");
       RETURN_IF_ERROR(controller_->ChipErase(device_info_));
       break;
     case ROW_ERASE:
-      erase_sections.erase(FLASH);
-      erase_sections.erase(EEPROM);
-    // FALLTHROUGH
+      // Changed flash rows are erased while writing them.
+      break;
     case SECTION_ERASE:
       // FIXME: this should pass the collection of sections to the controller to determine if it is
       // possible to erase this combination.
@@ -173,52 +255,114 @@ Status HighLevelController::WriteProgram(const std::vector<Section> &sections,
     case NO_ERASE:
       break;
     default:
-      fatal("Unsupported erase mode\n");
+      return Status(INVALID_ARGUMENT, "Unsupported erase mode");
   }
+  if (flash_erased && !shadow_known_.empty()) {
+    shadow_data_.clear();
+    AddFillerBytes(device_db_->GetBlockFillter(), device_info_.program_memory_size, &shadow_data_);
+    shadow_known_.assign(device_info_.program_memory_size, true);
+  }
+
+  // The key for the shadow file is read before writing the configuration, which may enable code
+  // protection. The planner only starts on the configuration after all other sections are done.
+  std::string shadow_path;
+  bool shadow_key_read = shadow_directory_.empty();
+  auto read_shadow_key = [this, &shadow_path, &shadow_key_read] {
+    if (shadow_key_read) {
+      return;
+    }
+    shadow_key_read = true;
+    Status status = GetShadowPath(&shadow_path);
+    if (!status.ok()) {
+      print_msg(1, "Could not read shadow key: %s\n", status.message().c_str());
+      shadow_path.clear();
+    }
+  };
 
+  // Sections that can't be verified while writing are verified in a later step, such that the
+  // planner can combine the verification with that of other sections in a single forward sweep.
+  std::vector<PlannedOperation> operations;
   for (const auto &section : block_aligned_program) {
-    if (ContainsKey(write_sections, FLASH) && section.first < device_info_.program_memory_size) {
-      print_msg(1, "Writing flash data %06X-%06X\n", section.first,
-                (uint32_t)(section.first + section.second.size()));
-      RETURN_IF_ERROR(controller_->Write(FLASH, section.first, section.second, device_info_));
-      print_msg(1, "Verifying written flash data\n");
-      RETURN_IF_ERROR(VerifyData(FLASH, section.second, section.first));
-    } else if (ContainsKey(write_sections, USER_ID) &&
-               section.first >= device_info_.user_id_address &&
-               section.first < device_info_.user_id_address + device_info_.user_id_size) {
-      print_msg(1, "Writing user ID data %06X-%06X\n", section.first,
-                (uint32_t)(section.first + section.second.size()));
-      RETURN_IF_ERROR(controller_->Write(USER_ID, section.first, section.second, device_info_));
-      print_msg(1, "Verifying written user ID data\n");
-      RETURN_IF_ERROR(VerifyData(USER_ID, section.second, section.first));
-    } else if (ContainsKey(write_sections, CONFIGURATION) &&
-               section.first >= device_info_.config_address &&
-               section.first < device_info_.config_address + device_info_.config_size) {
-      print_msg(1, "Writing configuration data %06X-%06X\n", section.first,
-                (uint32_t)(section.first + section.second.size()));
-      RETURN_IF_ERROR(
-          controller_->Write(CONFIGURATION, section.first, section.second, device_info_));
-      print_msg(1, "Verifying written configuration data\n");
-      RETURN_IF_ERROR(VerifyData(CONFIGURATION, section.second, section.first));
-    } else if (ContainsKey(write_sections, EEPROM) &&
-               section.first >= device_info_.eeprom_address &&
-               section.first < device_info_.eeprom_address + device_info_.eeprom_size) {
-      print_msg(1, "Writing EEPROM data %06X-%06X\n", section.first,
-                (uint32_t)(section.first + section.second.size()));
-      RETURN_IF_ERROR(controller_->Write(EEPROM, section.first, section.second, device_info_));
-      print_msg(1, "Verifying written EEPROM data\n");
-      RETURN_IF_ERROR(VerifyData(EEPROM, section.second, section.first));
+    Section type;
+    if (!AddressToSection(section.first, &type) || !ContainsKey(write_sections, type)) {
+      continue;
     }
+    const uint32_t address = section.first;
+    const Datastring *data = &section.second;
+    bool written = false;
+    operations.push_back(
+        {type, address,
+         [this, type, address, data, erase_mode, written,
+          &read_shadow_key](bool *done) mutable -> Status {
+           const uint32_t end_address = address + data->size();
+           if (type == FLASH && erase_mode == ROW_ERASE) {
+             return WriteChangedRows(*data, address);
+           }
+           if (type == CONFIGURATION) {
+             read_shadow_key();
+           }
+           if (!written) {
+             print_msg(1, "Writing %s data %06X-%06X\n", SectionToName(type), address,
+                       end_address);
+             bool verified;
+             RETURN_IF_ERROR(WriteData(type, *data, address, &verified));
+             written = true;
+             if (!verified) {
+               *done = false;
+               return Status::OK;
+             }
+           } else {
+             print_msg(1, "Verifying written %s data %06X-%06X\n", SectionToName(type), address,
+                       end_address);
+             RETURN_IF_ERROR(VerifyData(type, *data, address));
+           }
+           if (type == FLASH) {
+             UpdateShadow(address, *data);
+           }
+           return Status::OK;
+         }});
   }
+  RETURN_IF_ERROR(PerformPlanned(std::move(operations)));
 
+  read_shadow_key();
+  if (!shadow_path.empty()) {
+    SaveShadow(shadow_path);
+  }
   return Status::OK;
 }
 
+Status HighLevelController::VerifyProgram(const std::vector<Section> &sections,
+                                          const Program &program) {
+  std::set<Section> verify_sections(sections.begin(), sections.end());
+  DeviceCloser closer(this);
+  RETURN_IF_ERROR(InitDevice());
+  print_msg(1, "Initialized device [%s]\n", device_info_.name.c_str());
+
+  Program verify_program = program;
+  RemoveMissingConfigBytes(&verify_program, device_info_);
+  std::vector<PlannedOperation> operations;
+  for (const auto &section : verify_program) {
+    Section type;
+    if (!AddressToSection(section.first, &type) || !ContainsKey(verify_sections, type)) {
+      continue;
+    }
+    const uint32_t address = section.first;
+    const Datastring *data = &section.second;
+    operations.push_back({type, address, [this, type, address, data](bool *) {
+                            print_msg(1, "Verifying %s data %06X-%06X\n", SectionToName(type),
+                                      address, (uint32_t)(address + data->size()));
+                            return VerifyData(type, *data, address);
+                          }});
+  }
+  return PerformPlanned(std::move(operations));
+}
+
 Status HighLevelController::ChipErase() {
   DeviceCloser closer(this);
   RETURN_IF_ERROR(InitDevice());
   print_msg(1, "Initialized device [%s]\n", device_info_.name.c_str());
 
+  RETURN_IF_ERROR(InvalidateShadow());
   return controller_->ChipErase(device_info_);
 }
 
@@ -226,16 +370,46 @@ Status HighLevelController::SectionErase(const std::vector<Section> &sections) {
   DeviceCloser closer(this);
   RETURN_IF_ERROR(InitDevice());
 
+  if (std::find(sections.begin(), sections.end(), FLASH) != sections.end() ||
+      std::find(sections.begin(), sections.end(), USER_ID) != sections.end()) {
+    RETURN_IF_ERROR(InvalidateShadow());
+  }
   for (auto section : sections) {
+    RETURN_IF_ERROR(CheckCancelled());
     RETURN_IF_ERROR(controller_->SectionErase(section, device_info_));
   }
   return Status::OK;
 }
 
-Status HighLevelController::Identify() {
+Status HighLevelController::ReadDeviceInfo() {
   DeviceCloser closer(this);
-  RETURN_IF_ERROR(InitDevice());
-  printf("Device %s, revision %u\n", device_info_.name.c_str(), revision_);
+  return InitDevice();
+}
+
+Status HighLevelController::ProbeDevice(bool *present) {
+  *present = false;
+  if (!device_name_.empty()) {
+    DeviceInfo device_info;
+    RETURN_IF_ERROR(device_db_->GetDeviceInfo(device_name_, &device_info));
+    if (device_info.device_id == 0) {
+      return Status(UNIMPLEMENTED, strings::Cat("Device ", device_name_,
+                                                " has no device ID to detect its presence"));
+    }
+  }
+  AutoClosureRunner close([this] { controller_->Close(); });
+  RETURN_IF_ERROR(controller_->Open());
+  uint16_t device_id, revision;
+  Status status = controller_->ReadDeviceId(&device_id, &revision);
+  if (!status.ok()) {
+    // Without a device the data read is garbage, which may result in errors.
+    print_msg(3, "Reading device ID failed: %s\n", status.message().c_str());
+    return Status::OK;
+  }
+  DeviceInfo device_info;
+  if (device_id == 0 || !device_db_->GetDeviceInfo(device_id, &device_info).ok()) {
+    return Status::OK;
+  }
+  *present = device_name_.empty() || device_info.name == device_name_;
   return Status::OK;
 }
 
@@ -251,6 +425,7 @@ Status HighLevelController::InitDevice() {
   Status status;
   uint16_t device_id;
   for (int attempts = 0; attempts < 10; ++attempts) {
+    RETURN_IF_ERROR(CheckCancelled());
     status = controller_->Open();
     if (!status.ok()) {
       controller_->Close();
@@ -298,17 +473,31 @@ void HighLevelController::CloseDevice() {
   controller_->Close();
 }
 
+Status HighLevelController::CheckCancelled() const {
+  if (cancel_ != nullptr && cancel_->load()) {
+    return Status(CANCELLED, "Operation cancelled");
+  }
+  return Status::OK;
+}
+
 Status HighLevelController::ReadData(Section section, Datastring *data, uint32_t base_address,
                                      uint32_t target_size) {
-  AutoClosureRunner reset_line([] {
-    fprintf(stderr, "\r");
-    fflush(stderr);
+  bool printed_progress = false;
+  AutoClosureRunner reset_line([&printed_progress] {
+    if (printed_progress) {
+      print_msg(1, "\r");
+      fflush(stderr);
+    }
   });
   data->reserve(target_size);
   print_msg(2, "Starting read at address %06X to read %06X bytes\n", base_address, target_size);
   while (data->size() < target_size) {
-    print_msg(1, "\r%.0f%%", 100.0 * data->size() / target_size);
-    fflush(stderr);
+    RETURN_IF_ERROR(CheckCancelled());
+    if (!ReportProgressToSink(data->size(), target_size)) {
+      print_msg(1, "\r%.0f%%", 100.0 * data->size() / target_size);
+      fflush(stderr);
+      printed_progress = true;
+    }
 
     Datastring buffer;
     uint32_t start_address = base_address + data->size();
@@ -340,6 +529,244 @@ Status HighLevelController::ReadData(Section section, Datastring *data, uint32_t
   return Status::OK;
 }
 
+Status HighLevelController::WriteAndVerifyData(Section section, const Datastring &data,
+                                               uint32_t base_address) {
+  bool verified;
+  RETURN_IF_ERROR(WriteData(section, data, base_address, &verified));
+  if (!verified) {
+    print_msg(1, "Verifying written %s data\n", SectionToName(section));
+    return VerifyData(section, data, base_address);
+  }
+  return Status::OK;
+}
+
+Status HighLevelController::WriteData(Section section, const Datastring &data,
+                                      uint32_t base_address, bool *verified) {
+  Status status = controller_->WriteVerified(section, base_address, data, device_info_);
+  if (status.code() != UNIMPLEMENTED) {
+    *verified = status.ok();
+    return status;
+  }
+  *verified = false;
+  return controller_->Write(section, base_address, data, device_info_);
+}
+
+Status HighLevelController::PerformPlanned(std::vector<PlannedOperation> operations) {
+  while (!operations.empty()) {
+    RETURN_IF_ERROR(CheckCancelled());
+    const bool only_configuration = std::all_of(
+        operations.begin(), operations.end(),
+        [](const PlannedOperation &operation) { return operation.section == CONFIGURATION; });
+    size_t best = operations.size();
+    uint32_t best_cost = 0;
+    for (size_t i = 0; i < operations.size(); ++i) {
+      if (operations[i].section == CONFIGURATION && !only_configuration) {
+        continue;
+      }
+      uint32_t cost =
+          controller_->SeekCost(operations[i].section, operations[i].address, device_info_);
+      if (best == operations.size() || cost < best_cost) {
+        best = i;
+        best_cost = cost;
+      }
+    }
+    bool done = true;
+    RETURN_IF_ERROR(operations[best].perform(&done));
+    if (done) {
+      operations.erase(operations.begin() + best);
+    }
+  }
+  return Status::OK;
+}
+
+bool HighLevelController::AddressToSection(uint32_t address, Section *section) const {
+  if (address < device_info_.program_memory_size) {
+    *section = FLASH;
+  } else if (address >= device_info_.user_id_address &&
+             address < device_info_.user_id_address + device_info_.user_id_size) {
+    *section = USER_ID;
+  } else if (address >= device_info_.config_address &&
+             address < device_info_.config_address + device_info_.config_size) {
+    *section = CONFIGURATION;
+  } else if (address >= device_info_.eeprom_address &&
+             address < device_info_.eeprom_address + device_info_.eeprom_size) {
+    *section = EEPROM;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+Status HighLevelController::WriteChangedRows(const Datastring &data, uint32_t base_address) {
+  Datastring current_data;
+  bool from_shadow = false;
+  if (!shadow_known_.empty()) {
+    RETURN_IF_ERROR(ReadShadow(base_address, data.size(), &current_data, &from_shadow));
+  }
+  if (!from_shadow) {
+    print_msg(1, "Reading current flash data %06X-%06X\n", base_address,
+              (uint32_t)(base_address + data.size()));
+    current_data.clear();
+    RETURN_IF_ERROR(ReadData(FLASH, &current_data, base_address, data.size()));
+    UpdateShadow(base_address, current_data);
+  }
+
+  const size_t row_size = device_info_.row_erase_size;
+  auto row_changed = [&](size_t offset) {
+    size_t size = std::min(row_size, data.size() - offset);
+    return current_data.compare(offset, size, data, offset, size) != 0;
+  };
+  size_t offset = 0;
+  while (offset < data.size()) {
+    if (!row_changed(offset)) {
+      offset += row_size;
+      continue;
+    }
+    // Handle consecutive changed rows with a single write and verify.
+    size_t end = offset + row_size;
+    while (end < data.size() && row_changed(end)) {
+      end += row_size;
+    }
+    end = std::min(end, data.size());
+    for (size_t row = offset; row < end; row += row_size) {
+      RETURN_IF_ERROR(CheckCancelled());
+      RETURN_IF_ERROR(controller_->RowErase(base_address + row, device_info_));
+    }
+    Datastring changed_data = data.substr(offset, end - offset);
+    print_msg(1, "Writing changed flash data %06X-%06X\n", (uint32_t)(base_address + offset),
+              (uint32_t)(base_address + end));
+    RETURN_IF_ERROR(WriteAndVerifyData(FLASH, changed_data, base_address + offset));
+    UpdateShadow(base_address + offset, changed_data);
+    offset = end;
+  }
+  return Status::OK;
+}
+
+Status HighLevelController::GetShadowPath(std::string *path) {
+  Datastring key;
+  if (shadow_key_size_ > 0) {
+    RETURN_IF_ERROR(ReadData(FLASH, &key, shadow_key_address_, shadow_key_size_));
+  } else if (device_info_.user_id_size > 0) {
+    RETURN_IF_ERROR(
+        ReadData(USER_ID, &key, device_info_.user_id_address, device_info_.user_id_size));
+  }
+  // Devices with an empty or blank key can't be told apart, so they can't have a shadow.
+  const Datastring &filler = device_db_->GetBlockFillter();
+  bool blank = true;
+  for (size_t i = 0; i < key.size() && blank; ++i) {
+    blank = key[i] == filler[i % filler.size()];
+  }
+  if (blank) {
+    print_msg(1, "No shadow for this device, as its %s is blank\n",
+              shadow_key_size_ > 0 ? "serial number" : "user ID");
+    path->clear();
+    return Status::OK;
+  }
+  std::string name = HexUint16(device_info_.device_id);
+  name += '-';
+  for (const uint8_t byte : key) {
+    name += HexByte(byte);
+  }
+  *path = strings::Cat(shadow_directory_, "/", name, ".hex");
+  return Status::OK;
+}
+
+void HighLevelController::LoadShadow(const std::string &path) {
+  shadow_data_.assign(device_info_.program_memory_size, 0);
+  shadow_known_.assign(device_info_.program_memory_size, false);
+  if (path.empty()) {
+    return;
+  }
+  FILE *in = fopen(path.c_str(), "rb");
+  if (!in) {
+    return;
+  }
+  Program shadow;
+  Status status = ReadIhex(&shadow, in);
+  fclose(in);
+  if (!status.ok()) {
+    print_msg(1, "Ignoring invalid shadow file %s: %s\n", path.c_str(), status.message().c_str());
+    return;
+  }
+  print_msg(2, "Loaded shadow file %s\n", path.c_str());
+  for (const auto &section : shadow) {
+    UpdateShadow(section.first, section.second);
+  }
+}
+
+void HighLevelController::SaveShadow(const std::string &path) {
+  Program shadow;
+  for (uint32_t address = 0; address < shadow_known_.size();) {
+    if (!shadow_known_[address]) {
+      ++address;
+      continue;
+    }
+    uint32_t end = address;
+    while (end < shadow_known_.size() && shadow_known_[end]) {
+      ++end;
+    }
+    shadow[address] = shadow_data_.substr(address, end - address);
+    address = end;
+  }
+  FILE *out = fopen(path.c_str(), "wb");
+  if (!out) {
+    print_msg(1, "Could not write shadow file %s: %s\n", path.c_str(), strerror(errno));
+    return;
+  }
+  WriteIhex(shadow, out);
+  fclose(out);
+}
+
+Status HighLevelController::InvalidateShadow() {
+  if (shadow_directory_.empty()) {
+    return Status::OK;
+  }
+  std::string path;
+  RETURN_IF_ERROR(GetShadowPath(&path));
+  if (!path.empty()) {
+    remove(path.c_str());
+  }
+  return Status::OK;
+}
+
+void HighLevelController::UpdateShadow(uint32_t address, const Datastring &data) {
+  for (size_t i = 0; i < data.size() && address + i < shadow_known_.size(); ++i) {
+    shadow_data_[address + i] = data[i];
+    shadow_known_[address + i] = true;
+  }
+}
+
+Status HighLevelController::ReadShadow(uint32_t base_address, size_t size, Datastring *data,
+                                       bool *found) {
+  *found = false;
+  if (size == 0 || base_address + size > shadow_known_.size()) {
+    return Status::OK;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (!shadow_known_[base_address + i]) {
+      return Status::OK;
+    }
+  }
+  // Check rows spread evenly over the range against the device, to detect devices which were
+  // modified without updating the shadow. This includes the first and the last row.
+  const size_t row_size = std::min<size_t>(device_info_.write_block_size, size);
+  const size_t rows = (size + row_size - 1) / row_size;
+  const size_t samples = std::min(rows, kShadowSpotCheckRows);
+  for (size_t i = 0; i < samples; ++i) {
+    const size_t row_index = samples > 1 ? i * (rows - 1) / (samples - 1) : 0;
+    const size_t offset = std::min(row_index * row_size, size - row_size);
+    Datastring row;
+    RETURN_IF_ERROR(ReadData(FLASH, &row, base_address + offset, row_size));
+    if (row != shadow_data_.substr(base_address + offset, row_size)) {
+      print_msg(1, "Shadow does not match device, reading flash contents\n");
+      return Status::OK;
+    }
+  }
+  *data = shadow_data_.substr(base_address, size);
+  *found = true;
+  return Status::OK;
+}
+
 Status HighLevelController::VerifyData(Section section, const Datastring &data,
                                        uint32_t base_address) {
   Datastring written_data;
@@ -14,22 +14,51 @@
 #ifndef HIGH_LEVEL_CONTROLLER_H_
 #define HIGH_LEVEL_CONTROLLER_H_
 
+#include <atomic>
+#include <functional>
+
 #include "controller.h"
 #include "util.h"
 
 class HighLevelController {
  public:
-  HighLevelController(std::unique_ptr<Controller> controller, std::unique_ptr<DeviceDb> device_db)
+  HighLevelController(std::unique_ptr<Controller> controller,
+                      std::shared_ptr<const DeviceDb> device_db)
       : controller_(std::move(controller)), device_db_(std::move(device_db)) {}
 
   void SetDevice(const std::string &device_name) { device_name_ = device_name; }
+  // Sets a flag which is polled during operations. Once it is set, operations stop and return
+  // CANCELLED.
+  void SetCancelFlag(const std::atomic<bool> *cancel) { cancel_ = cancel; }
+  // Enables keeping a copy (shadow) of the flash contents of each written device in directory.
+  // When writing with ROW_ERASE, the shadow is used instead of reading the entire flash, after
+  // checking that a few rows match. Devices are identified by their device ID and the key_size
+  // bytes of flash at key_address, or by their user ID if key_size is 0. Devices with a blank key
+  // don't get a shadow.
+  void SetShadow(const std::string &directory, uint32_t key_address, uint32_t key_size) {
+    shadow_directory_ = directory;
+    shadow_key_address_ = key_address;
+    shadow_key_size_ = key_size;
+  }
 
   Status ReadProgram(const std::vector<Section> &sections, Program *program);
   Status WriteProgram(const std::vector<Section> &sections, const Program &program,
                       EraseMode erase_mode);
+  // Compares the contents of the selected sections of the device with program.
+  Status VerifyProgram(const std::vector<Section> &sections, const Program &program);
   Status ChipErase();
   Status SectionErase(const std::vector<Section> &sections);
-  Status Identify();
+  // Identifies the connected device. The result is available through device_info() and
+  // revision().
+  Status ReadDeviceInfo();
+  // Checks once, without retries, whether a device with a device ID listed in the device DB is
+  // connected. Sets *present accordingly. Only fails if the programmer itself fails, or if the
+  // selected device has no device ID.
+  Status ProbeDevice(bool *present);
+
+  // Returns the information of the device found by the last operation.
+  const DeviceInfo &device_info() const { return device_info_; }
+  uint16_t revision() const { return revision_; }
 
  private:
   class DeviceCloser {
@@ -42,15 +71,65 @@ class HighLevelController {
   };
   Status InitDevice();
   void CloseDevice();
+  Status CheckCancelled() const;
   Status ReadData(Section section, Datastring *data, uint32_t base_address, uint32_t target_size);
   Status VerifyData(Section, const Datastring &data, uint32_t base_address);
+  // Writes data to the section at base_address, and verifies it.
+  Status WriteAndVerifyData(Section section, const Datastring &data, uint32_t base_address);
+  // Writes data to the section at base_address. If the controller supports verified writes, each
+  // unit is read back directly after writing it, and *verified is set to true. Otherwise the data
+  // still has to be verified.
+  Status WriteData(Section section, const Datastring &data, uint32_t base_address,
+                   bool *verified);
+  // An operation on a section of the device, ordered by PerformPlanned.
+  struct PlannedOperation {
+    Section section;
+    uint32_t address;
+    // Performs (the next step of) the operation. Sets *done to false if the operation has to be
+    // performed again, e.g. to verify data after writing it.
+    std::function<Status(bool *done)> perform;
+  };
+  // Performs the operations, each time choosing the operation with the lowest Controller::SeekCost.
+  // Operations on the configuration are performed after all others, as the configuration may
+  // enable code protection.
+  Status PerformPlanned(std::vector<PlannedOperation> operations);
+  // Determines the section containing address. Returns false if no section contains it.
+  bool AddressToSection(uint32_t address, Section *section) const;
+  // Erases and writes only the flash rows in data which differ from the current contents.
+  Status WriteChangedRows(const Datastring &data, uint32_t base_address);
+
+  // Determines the path of the shadow file for the connected device. Sets *path to an empty string
+  // if the key identifying the device is blank.
+  Status GetShadowPath(std::string *path);
+  // Loads the shadow from path, if it exists. Starts with an empty shadow otherwise, or if path is
+  // empty.
+  void LoadShadow(const std::string &path);
+  // Writes the known parts of the shadow to path. Failures are only reported, as the device itself
+  // has been written successfully.
+  void SaveShadow(const std::string &path);
+  // Removes the shadow file of the connected device, if the shadow is enabled.
+  Status InvalidateShadow();
+  // Records that the flash at address contains data. Does nothing if no shadow is loaded.
+  void UpdateShadow(uint32_t address, const Datastring &data);
+  // Retrieves the flash contents at base_address from the shadow. Sets *found to false if the
+  // shadow does not cover the entire range, or if one of the rows spot checked on the device
+  // doesn't match.
+  Status ReadShadow(uint32_t base_address, size_t size, Datastring *data, bool *found);
 
   bool device_open_ = false;
   DeviceInfo device_info_;
   uint16_t revision_ = 0;
   std::unique_ptr<Controller> controller_;
-  std::unique_ptr<DeviceDb> device_db_;
+  std::shared_ptr<const DeviceDb> device_db_;
   std::string device_name_;
+  const std::atomic<bool> *cancel_ = nullptr;
+
+  std::string shadow_directory_;
+  uint32_t shadow_key_address_ = 0;
+  uint32_t shadow_key_size_ = 0;
+  // Shadow of the program memory, and which of its bytes are known.
+  Datastring shadow_data_;
+  std::vector<bool> shadow_known_;
 };
 
 #endif
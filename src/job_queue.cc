@@ -0,0 +1,139 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "job_queue.h"
+
+#include <cerrno>
+#include <cstring>
+#include <regex>
+
+#include "strings.h"
+
+static Status ValidateJob(const Job &job) {
+  if (job.family.empty()) {
+    return Status(PARSE_ERROR, "No family specified");
+  }
+  if (job.action == "write-program" || job.action == "verify") {
+    if (job.input.empty()) {
+      return Status(PARSE_ERROR, "No input specified");
+    }
+  } else if (job.action == "erase") {
+    if (job.sections.empty()) {
+      return Status(PARSE_ERROR, "Erase requires setting sections");
+    }
+  } else if (job.action != "identify") {
+    return Status(PARSE_ERROR, strings::Cat("Unsupported action '", job.action, "'"));
+  }
+  if (job.erase_mode != "chip" && job.erase_mode != "section" && job.erase_mode != "row" &&
+      job.erase_mode != "none") {
+    return Status(PARSE_ERROR, strings::Cat("No such erase mode '", job.erase_mode, "'"));
+  }
+  return Status::OK;
+}
+
+Status ParseJob(const std::string &description, Job *job) {
+  std::vector<std::string> fields;
+  for (const std::string &field : strings::Split<std::string>(description, ' ', false)) {
+    for (const std::string &subfield : strings::Split<std::string>(field, '\t', false)) {
+      fields.push_back(subfield);
+    }
+  }
+  std::regex key_value_regex(R"((\w+)=(\S*))");
+  for (const std::string &field : fields) {
+    std::smatch match_results;
+    if (!std::regex_match(field, match_results, key_value_regex)) {
+      return Status(PARSE_ERROR, strings::Cat("Invalid field '", field, "'"));
+    }
+    const std::string &key = match_results[1].str();
+    const std::string &value = match_results[2].str();
+    if (key == "action") {
+      job->action = value;
+    } else if (key == "family") {
+      job->family = value;
+    } else if (key == "device") {
+      job->device = value;
+    } else if (key == "device_db") {
+      job->device_db = value;
+    } else if (key == "input") {
+      job->input = value;
+    } else if (key == "sections") {
+      job->sections = value;
+    } else if (key == "erase_mode") {
+      job->erase_mode = value;
+    } else {
+      return Status(PARSE_ERROR, strings::Cat("Unknown key '", key, "'"));
+    }
+  }
+  return ValidateJob(*job);
+}
+
+Status LoadJobs(const std::string &name, std::vector<Job> *jobs) {
+  FILE *in;
+  if ((in = fopen(name.c_str(), "r")) == nullptr) {
+    return Status(FILE_NOT_FOUND,
+                  strings::Cat("Could not open job file '", name, "': ", strerror(errno)));
+  }
+
+  std::string contents;
+  char buffer[1024];
+  ssize_t bytes_read;
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    contents.append(buffer, bytes_read);
+  }
+  bool read_error = !feof(in) || ferror(in);
+  fclose(in);
+  if (read_error) {
+    return Status(PARSE_ERROR,
+                  strings::Cat("Could not read job file '", name, "': ", strerror(errno)));
+  }
+
+  std::vector<std::string> lines = strings::Split<std::string>(contents, '\n', true);
+  std::regex skip_regex(R"(\s*(#.*)?)");
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (std::regex_match(lines[i], skip_regex)) {
+      continue;
+    }
+    Job job;
+    job.line = i + 1;
+    RETURN_IF_ERROR_WITH_APPEND(ParseJob(lines[i], &job),
+                                strings::Cat(" in job file at line ", i + 1));
+    jobs->push_back(job);
+  }
+  return Status::OK;
+}
+
+void WorkStealingQueue::Push(size_t worker, size_t item) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  queues_[worker].push_back(item);
+}
+
+bool WorkStealingQueue::Pop(size_t worker, size_t *item) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!queues_[worker].empty()) {
+    *item = queues_[worker].front();
+    queues_[worker].pop_front();
+    return true;
+  }
+  std::deque<size_t> *victim = nullptr;
+  for (std::deque<size_t> &queue : queues_) {
+    if (!queue.empty() && (victim == nullptr || queue.size() > victim->size())) {
+      victim = &queue;
+    }
+  }
+  if (victim == nullptr) {
+    return false;
+  }
+  *item = victim->back();
+  victim->pop_back();
+  return true;
+}
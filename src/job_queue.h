@@ -0,0 +1,61 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef JOB_QUEUE_H_
+#define JOB_QUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+// A single action to perform on a target, as described by a line in a job file.
+struct Job {
+  // Line in the job file describing this job, for reporting.
+  int line = 0;
+  std::string action = "write-program";
+  std::string family;
+  std::string device;
+  std::string device_db;
+  std::string input;
+  std::string sections;
+  std::string erase_mode = "chip";
+};
+
+// Parses a job description, consisting of whitespace separated key=value pairs, into job. The keys
+// correspond to the flags with the same name.
+Status ParseJob(const std::string &description, Job *job);
+
+// Loads the jobs from the file name. Each non-empty line of the file describes one job. Lines
+// starting with # are ignored.
+Status LoadJobs(const std::string &name, std::vector<Job> *jobs);
+
+// Distributes work items over a fixed set of workers. Each worker has its own queue, which it
+// processes from the front. When a worker's queue is empty, it takes an item from the back of the
+// longest queue of the other workers.
+class WorkStealingQueue {
+ public:
+  explicit WorkStealingQueue(size_t workers) : queues_(workers) {}
+
+  void Push(size_t worker, size_t item);
+  // Retrieves the next item for worker. Returns false if no items are left for any worker.
+  bool Pop(size_t worker, size_t *item);
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::deque<size_t>> queues_;
+};
+
+#endif
@@ -28,9 +28,7 @@ void Pic16ControllerBase::Close() { driver_->Close(); }
 Status Pic16ControllerBase::ReadDeviceId(uint16_t *device_id, uint16_t *revision) {
   RETURN_IF_ERROR(WriteCommand(Pic16Command::LOAD_CONFIGURATION, 0));
 
-  for (int i = 0; i < 5; ++i) {
-    RETURN_IF_ERROR(WriteCommand(Pic16Command::INCREMENT_ADDRESS));
-  }
+  RETURN_IF_ERROR(WriteIncrements(5));
   // The PIC16 family has two different formats for device and revision ID. The first format stores
   // all information in configuration word 6, the second uses configuration word 5 for the revision
   // ID and word 6 for the device ID. The revision ID then starts with 10b, the device ID with 11b.
@@ -76,6 +74,19 @@ Status Pic16ControllerBase::Read(Section section, uint32_t start_address, uint32
 
 Status Pic16ControllerBase::Write(Section section, uint32_t address, const Datastring &data,
                                   const DeviceInfo &device_info) {
+  return WriteWords(section, address, data, device_info, false);
+}
+
+Status Pic16ControllerBase::WriteVerified(Section section, uint32_t address, const Datastring &data,
+                                          const DeviceInfo &device_info) {
+  if (section == FLASH && device_info.write_block_size != 2) {
+    return Status(UNIMPLEMENTED, "Verified writes require a write_block_size of one word");
+  }
+  return WriteWords(section, address, data, device_info, true);
+}
+
+Status Pic16ControllerBase::WriteWords(Section section, uint32_t address, const Datastring &data,
+                                       const DeviceInfo &device_info, bool verify) {
   RETURN_IF_ERROR(LoadAddress(section, address, device_info));
 
   if (section == FLASH) {
@@ -88,8 +99,9 @@ Status Pic16ControllerBase::Write(Section section, uint32_t address, const Datas
     }
     for (size_t base = 0; base < data.size(); base += block_size) {
       PrintProgress(base, data.size());
+      uint16_t datum = 0;
       for (uint32_t i = 0; i < block_size; i += 2) {
-        uint16_t datum = data[base + i + 1];
+        datum = data[base + i + 1];
         datum <<= 8;
         datum |= static_cast<uint8_t>(data[base + i]);
         RETURN_IF_ERROR(WriteCommand(Pic16Command::LOAD_PROG_MEMORY, datum));
@@ -99,6 +111,10 @@ Status Pic16ControllerBase::Write(Section section, uint32_t address, const Datas
       }
       RETURN_IF_ERROR(
           WriteTimedSequence(Pic16SequenceGenerator::WRITE_DATA_SEQUENCE, &device_info));
+      if (verify) {
+        // Only single word blocks are verified, so datum is the only word of the block.
+        RETURN_IF_ERROR(VerifyWord(section, datum));
+      }
       RETURN_IF_ERROR(IncrementPc(device_info));
     }
   } else {
@@ -118,12 +134,33 @@ Status Pic16ControllerBase::Write(Section section, uint32_t address, const Datas
           datum));
       RETURN_IF_ERROR(
           WriteTimedSequence(Pic16SequenceGenerator::WRITE_DATA_SEQUENCE, &device_info));
+      if (verify) {
+        RETURN_IF_ERROR(VerifyWord(section, datum));
+      }
       RETURN_IF_ERROR(IncrementPc(device_info));
     }
   }
   return Status::OK;
 }
 
+Status Pic16ControllerBase::VerifyWord(Section section, uint16_t datum) {
+  uint16_t read_datum;
+  Status status(SYNC_LOST, "FAKE STATUS");
+  for (int j = 0; j < 3 && status.code() == SYNC_LOST; ++j) {
+    status = ReadWithCommand(
+        section == EEPROM ? Pic16Command::READ_DATA_MEMORY : Pic16Command::READ_PROG_MEMORY,
+        &read_datum);
+  }
+  RETURN_IF_ERROR(status);
+  // Only 14 bits are read back.
+  if ((read_datum & 0x3fff) != (datum & 0x3fff)) {
+    return Status(VERIFICATION_ERROR, strings::Cat("Data read back (", HexUint16(read_datum),
+                                                   ") is not what was written (", HexUint16(datum),
+                                                   ")"));
+  }
+  return Status::OK;
+}
+
 Status Pic16ControllerBase::ChipErase(const DeviceInfo &device_info) {
   Datastring calibration_word;
   if (device_info.calibration_word_address != 0) {
@@ -163,6 +200,10 @@ Status Pic16ControllerBase::ReadWithCommand(Pic16Command command, uint16_t *resu
   return Status::OK;
 }
 
+Status Pic16ControllerBase::WriteIncrements(uint32_t count) {
+  return driver_->WriteRepeated(increment_sequence_, count);
+}
+
 Status Pic16ControllerBase::WriteTimedSequence(Pic16SequenceGenerator::TimedSequenceType type,
                                                const DeviceInfo *device_info) {
   return driver_->WriteTimedSequence(sequence_generator_->GetTimedSequence(type, device_info));
@@ -192,19 +233,37 @@ Status Pic16MidrangeController::LoadAddress(Section section, uint32_t address,
     fatal("INTERNAL ERROR: last_address_ (%04x) should be <= start_address (%04x)\n", last_address_,
           address);
   }
-  while (last_address_ < address) {
-    RETURN_IF_ERROR(IncrementPc(device_info));
+  if (last_address_ < address) {
+    RETURN_IF_ERROR(IncrementPcBy((address - last_address_ + 1) / 2, device_info));
   }
   return Status::OK;
 }
 
-Status Pic16MidrangeController::IncrementPc(const DeviceInfo &device_info) {
-  RETURN_IF_ERROR(WriteCommand(Pic16Command::INCREMENT_ADDRESS));
+uint32_t Pic16MidrangeController::SeekCost(Section section, uint32_t address,
+                                          const DeviceInfo &device_info) const {
+  if (section == CONFIGURATION) {
+    if (last_address_ >= device_info.config_address && last_address_ <= address) {
+      return (address - last_address_) / 2;
+    }
+    // LOAD_CONFIGURATION, followed by the increments.
+    return 1 + (address - device_info.config_address) / 2;
+  }
+  if (section == EEPROM) {
+    address -= device_info.eeprom_address;
+  }
+  if (last_address_ <= address) {
+    return (address - last_address_) / 2;
+  }
+  return kResetCost + address / 2;
+}
+
+Status Pic16MidrangeController::IncrementPcBy(uint32_t count, const DeviceInfo &device_info) {
+  RETURN_IF_ERROR(WriteIncrements(count));
   bool was_config = false;
   if (last_address_ >= device_info.config_address) {
     was_config = true;
   }
-  last_address_ += 2;
+  last_address_ += 2 * count;
   if (last_address_ >= device_info.config_address && !was_config) {
     // Force a reset of the PC if an overflow into the config area was detected.
     last_address_ = std::numeric_limits<uint32_t>::max();
@@ -239,16 +298,28 @@ Status Pic16BaselineController::LoadAddress(Section section, uint32_t address,
     fatal("INTERNAL ERROR: last_address_ (%04x) should be <= start_address (%04x)\n", last_address_,
           address);
   }
-  while (last_address_ < address) {
-    RETURN_IF_ERROR(IncrementPc(device_info));
+  if (last_address_ < address) {
+    RETURN_IF_ERROR(IncrementPcBy((address - last_address_ + 1) / 2, device_info));
   }
   return Status::OK;
 }
 
-Status Pic16BaselineController::IncrementPc(const DeviceInfo &) {
-  RETURN_IF_ERROR(WriteCommand(Pic16Command::INCREMENT_ADDRESS));
+uint32_t Pic16BaselineController::SeekCost(Section section, uint32_t address,
+                                          const DeviceInfo &) const {
+  if (section == CONFIGURATION) {
+    return last_address_ == kConfigurationAddress ? 0 : kResetCost;
+  }
+  if (last_address_ <= address) {
+    return (address - last_address_) / 2;
+  }
+  // Reset, followed by an increment to wrap from the configuration word to address 0.
+  return kResetCost + 1 + address / 2;
+}
+
+Status Pic16BaselineController::IncrementPcBy(uint32_t count, const DeviceInfo &) {
+  RETURN_IF_ERROR(WriteIncrements(count));
   // This will wrap around to 0 if the address is the configuration location.
-  last_address_ += 2;
+  last_address_ += 2 * count;
   return Status::OK;
 }
 
@@ -27,7 +27,10 @@ class Pic16ControllerBase : public Controller {
  public:
   Pic16ControllerBase(std::unique_ptr<Driver> driver,
                       std::unique_ptr<Pic16SequenceGenerator> sequence_generator)
-      : driver_(std::move(driver)), sequence_generator_(std::move(sequence_generator)) {}
+      : driver_(std::move(driver)),
+        sequence_generator_(std::move(sequence_generator)),
+        increment_sequence_(sequence_generator_->GetCommandSequence(
+            static_cast<uint8_t>(Pic16Command::INCREMENT_ADDRESS))) {}
 
   Status Open() override;
   void Close() override;
@@ -36,42 +39,70 @@ class Pic16ControllerBase : public Controller {
               const DeviceInfo &device_info, Datastring *result) override;
   Status Write(Section section, uint32_t address, const Datastring &data,
                const DeviceInfo &device_info) override;
+  // Only implemented for sections written one word at a time, as the PC can't be moved back to
+  // the start of a multi-word write latch.
+  Status WriteVerified(Section section, uint32_t address, const Datastring &data,
+                       const DeviceInfo &device_info) override;
   Status ChipErase(const DeviceInfo &device_info) override;
   Status SectionErase(Section section, const DeviceInfo &device_info) override;
 
  protected:
   virtual Status LoadAddress(Section section, uint32_t address, const DeviceInfo &device_info) = 0;
   virtual Status ResetDevice() = 0;
-  virtual Status IncrementPc(const DeviceInfo &device_info) = 0;
+  // Increments the PC count times, using a single repeated command sequence.
+  virtual Status IncrementPcBy(uint32_t count, const DeviceInfo &device_info) = 0;
+  Status IncrementPc(const DeviceInfo &device_info) { return IncrementPcBy(1, device_info); }
 
   Status WriteCommand(Pic16Command command, uint16_t payload);
   Status WriteCommand(Pic16Command command);
   Status ReadWithCommand(Pic16Command command, uint16_t *data);
+  // Writes the INCREMENT_ADDRESS command count times, without updating the tracked PC.
+  Status WriteIncrements(uint32_t count);
   Status WriteTimedSequence(Pic16SequenceGenerator::TimedSequenceType type,
                             const DeviceInfo *device_info);
 
+  // Estimated cost of ResetDevice, in commands. The reset sequence takes about as long as
+  // shifting out this many commands.
+  static constexpr uint32_t kResetCost = 1000;
+
  private:
+  // Implements Write and WriteVerified. If verify is set, each word is read back after
+  // programming, which requires single word writes.
+  Status WriteWords(Section section, uint32_t address, const Datastring &data,
+                    const DeviceInfo &device_info, bool verify);
+  // Reads the word at the PC, and compares it to the word written.
+  Status VerifyWord(Section section, uint16_t datum);
+
   std::unique_ptr<Driver> driver_;
   std::unique_ptr<Pic16SequenceGenerator> sequence_generator_;
+  const Datastring increment_sequence_;
 };
 
 class Pic16MidrangeController : public Pic16ControllerBase {
+ public:
+  uint32_t SeekCost(Section section, uint32_t address,
+                    const DeviceInfo &device_info) const override;
+
  protected:
   using Pic16ControllerBase::Pic16ControllerBase;
 
   Status LoadAddress(Section section, uint32_t address, const DeviceInfo &device_info) override;
-  Status IncrementPc(const DeviceInfo &device_info) override;
+  Status IncrementPcBy(uint32_t count, const DeviceInfo &device_info) override;
   Status ResetDevice() override;
 
   uint32_t last_address_ = 0;
 };
 
 class Pic16BaselineController : public Pic16ControllerBase {
+ public:
+  uint32_t SeekCost(Section section, uint32_t address,
+                    const DeviceInfo &device_info) const override;
+
  protected:
   using Pic16ControllerBase::Pic16ControllerBase;
 
   Status LoadAddress(Section section, uint32_t address, const DeviceInfo &device_info) override;
-  Status IncrementPc(const DeviceInfo &device_info) override;
+  Status IncrementPcBy(uint32_t count, const DeviceInfo &device_info) override;
   Status ResetDevice() override;
 
   static constexpr uint32_t kConfigurationAddress = std::numeric_limits<uint32_t>::max() - 1;
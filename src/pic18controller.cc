@@ -67,45 +67,8 @@ Status Pic18Controller::Read(Section section, uint32_t start_address, uint32_t e
 
 Status Pic18Controller::Write(Section section, uint32_t address, const Datastring &data,
                               const DeviceInfo &device_info) {
-  uint32_t block_size = 1;
-  if (section == FLASH) {
-    block_size = device_info.write_block_size;
-  } else if (section == USER_ID) {
-    block_size = device_info.user_id_size;
-  }
-  if (data.size() % block_size) {
-    return Status(Code::INVALID_ARGUMENT,
-                  strings::Cat("Data must be a multiple of the block size (", data.size(), " / ",
-                               block_size, ")"));
-  }
-  if (address % block_size != 0) {
-    return Status(Code::INVALID_ARGUMENT,
-                  strings::Cat("Write address must be a multiple of the block size (", address,
-                               " / ", block_size, ")"));
-  }
   if (section == FLASH || section == USER_ID) {
-    if (block_size % 2 != 0 || block_size < 2) {
-      return Status(Code::INVALID_ARGUMENT, "Block size for writing must be a multiple of 2");
-    }
-    for (size_t i = 0; i < data.size(); i += block_size) {
-      PrintProgress(i, data.size());
-
-      // BSF EECON1, EEPGD
-      RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x8EA6));
-      // BCF EECON1, CFGS
-      RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x9CA6));
-      // BSF EECON1, WREN
-      RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x84A6));
-      RETURN_IF_ERROR(LoadAddress(address + i));
-      for (size_t j = 0; j < block_size - 2; j += 2) {
-        RETURN_IF_ERROR(WriteCommand(Pic18Command::TABLE_WRITE_post_inc2,
-                                     (static_cast<uint16_t>(data[i + j + 1]) << 8) | data[i + j]));
-      }
-      RETURN_IF_ERROR(WriteCommand(
-          Pic18Command::TABLE_WRITE_post_inc2_start_pgm,
-          (static_cast<uint16_t>(data[i + block_size - 1]) << 8) | data[i + block_size - 2]));
-      RETURN_IF_ERROR(WriteTimedSequence(Pic18SequenceGenerator::WRITE_SEQUENCE, &device_info));
-    }
+    return WriteBlocks(section, address, data, device_info, false);
   } else if (section == CONFIGURATION) {
     for (const uint8_t byte : data) {
       // BSF EECON1, EEPGD
@@ -163,6 +126,77 @@ Status Pic18Controller::Write(Section section, uint32_t address, const Datastrin
   return Status::OK;
 }
 
+Status Pic18Controller::WriteVerified(Section section, uint32_t address, const Datastring &data,
+                                      const DeviceInfo &device_info) {
+  if (section != FLASH && section != USER_ID) {
+    return Status(UNIMPLEMENTED, "Verified writes are only implemented for flash and user ID");
+  }
+  return WriteBlocks(section, address, data, device_info, true);
+}
+
+Status Pic18Controller::WriteBlocks(Section section, uint32_t address, const Datastring &data,
+                                    const DeviceInfo &device_info, bool verify) {
+  uint32_t block_size = section == FLASH ? device_info.write_block_size : device_info.user_id_size;
+  if (block_size % 2 != 0 || block_size < 2) {
+    return Status(Code::INVALID_ARGUMENT, "Block size for writing must be a multiple of 2");
+  }
+  if (data.size() % block_size) {
+    return Status(Code::INVALID_ARGUMENT,
+                  strings::Cat("Data must be a multiple of the block size (", data.size(), " / ",
+                               block_size, ")"));
+  }
+  if (address % block_size != 0) {
+    return Status(Code::INVALID_ARGUMENT,
+                  strings::Cat("Write address must be a multiple of the block size (", address,
+                               " / ", block_size, ")"));
+  }
+  const TimedSequence write_sequence =
+      sequence_generator_->GetTimedSequence(Pic18SequenceGenerator::WRITE_SEQUENCE, &device_info);
+  for (size_t i = 0; i < data.size(); i += block_size) {
+    PrintProgress(i, data.size());
+
+    // BSF EECON1, EEPGD
+    RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x8EA6));
+    // BCF EECON1, CFGS
+    RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x9CA6));
+    // BSF EECON1, WREN
+    RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x84A6));
+    RETURN_IF_ERROR(LoadAddress(address + i));
+    for (size_t j = 0; j < block_size - 2; j += 2) {
+      RETURN_IF_ERROR(WriteCommand(Pic18Command::TABLE_WRITE_post_inc2,
+                                   (static_cast<uint16_t>(data[i + j + 1]) << 8) | data[i + j]));
+    }
+    RETURN_IF_ERROR(WriteCommand(
+        Pic18Command::TABLE_WRITE_post_inc2_start_pgm,
+        (static_cast<uint16_t>(data[i + block_size - 1]) << 8) | data[i + block_size - 2]));
+    if (!verify) {
+      RETURN_IF_ERROR(driver_->WriteTimedSequence(write_sequence));
+      continue;
+    }
+    // The block is read back in the same stream as its programming sequence. When the driver
+    // times the programming delay in the stream, writing and verifying a block thus takes a single
+    // round trip to the programmer.
+    RETURN_IF_ERROR(driver_->QueueTimedSequence(write_sequence));
+    RETURN_IF_ERROR(VerifyBlock(address + i, data.substr(i, block_size)));
+  }
+  return Status::OK;
+}
+
+Status Pic18Controller::VerifyBlock(uint32_t address, const Datastring &data) {
+  Datastring read_data;
+  Status status(SYNC_LOST, "FAKE STATUS");
+  for (int attempt = 0; attempt < 3 && status.code() == SYNC_LOST; ++attempt) {
+    RETURN_IF_ERROR(LoadAddress(address));
+    status = ReadWithCommand(Pic18Command::TABLE_READ_post_inc, data.size(), &read_data);
+  }
+  RETURN_IF_ERROR(status);
+  if (read_data != data) {
+    return Status(VERIFICATION_ERROR, strings::Cat("Data read back at ", HexUint32(address),
+                                                   " is not what was written"));
+  }
+  return Status::OK;
+}
+
 Status Pic18Controller::ChipErase(const DeviceInfo &device_info) {
   return ExecuteBulkErase(device_info.chip_erase_sequence, device_info);
 }
@@ -183,6 +217,25 @@ Status Pic18Controller::SectionErase(Section section, const DeviceInfo &device_i
   }
 }
 
+Status Pic18Controller::RowErase(uint32_t address, const DeviceInfo &device_info) {
+  // BSF EECON1, EEPGD
+  RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x8EA6));
+  // BCF EECON1, CFGS
+  RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x9CA6));
+  // BSF EECON1, WREN
+  RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x84A6));
+  RETURN_IF_ERROR(LoadAddress(address));
+  // BSF EECON1, FREE
+  RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x88A6));
+  // BSF EECON1, WR
+  RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x82A6));
+  // NOP
+  RETURN_IF_ERROR(WriteCommand(Pic18Command::CORE_INST, 0x0000));
+  RETURN_IF_ERROR(WriteTimedSequence(Pic18SequenceGenerator::ROW_ERASE_SEQUENCE, &device_info));
+  // BCF EECON1, WREN
+  return WriteCommand(Pic18Command::CORE_INST, 0x94A6);
+}
+
 Status Pic18Controller::WriteCommand(Pic18Command command, uint16_t payload) {
   return driver_->WriteDatastring(sequence_generator_->GetCommandSequence(command, payload));
 }
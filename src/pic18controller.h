@@ -36,8 +36,12 @@ class Pic18Controller : public Controller {
               const DeviceInfo &device_info, Datastring *result) override;
   Status Write(Section section, uint32_t address, const Datastring &data,
                const DeviceInfo &device_info) override;
+  // Only implemented for the flash and user ID, which are written in blocks.
+  Status WriteVerified(Section section, uint32_t address, const Datastring &data,
+                       const DeviceInfo &device_info) override;
   Status ChipErase(const DeviceInfo &device_info) override;
   Status SectionErase(Section section, const DeviceInfo &device_info) override;
+  Status RowErase(uint32_t address, const DeviceInfo &device_info) override;
 
  private:
   Status WriteCommand(Pic18Command command, uint16_t payload);
@@ -47,6 +51,12 @@ class Pic18Controller : public Controller {
   Status LoadAddress(uint32_t address);
   Status LoadEepromAddress(uint32_t address);
   Status ExecuteBulkErase(const Datastring16 &sequence, const DeviceInfo &device_info);
+  // Implements Write and WriteVerified for the flash and user ID. If verify is set, each block is
+  // read back directly after programming it.
+  Status WriteBlocks(Section section, uint32_t address, const Datastring &data,
+                     const DeviceInfo &device_info, bool verify);
+  // Reads the data at address, and compares it to the data written.
+  Status VerifyBlock(uint32_t address, const Datastring &data);
 
   std::unique_ptr<Driver> driver_;
   std::unique_ptr<Pic18SequenceGenerator> sequence_generator_;
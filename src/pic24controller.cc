@@ -125,7 +125,7 @@ Status Pic24Controller::Write(Section section, uint32_t address, const Datastrin
   if (device_info.block_write_sequence.size() != 1 ||
       device_info.config_write_sequence.size() != 1 ||
       device_info.eeprom_write_sequence.size() > 1) {
-    fatal("DeviceInfo is invalid for writing\n");
+    return Status(Code::INVALID_ARGUMENT, "DeviceInfo is invalid for writing");
   }
 
   uint32_t write_command;
@@ -135,9 +135,12 @@ Status Pic24Controller::Write(Section section, uint32_t address, const Datastrin
     write_command = device_info.config_write_sequence[0];
   } else if (section == EEPROM) {
     if (device_info.eeprom_write_sequence.size() != 1) {
-      fatal("Device info does not allow EEPROM writes\n");
+      return Status(Code::INVALID_ARGUMENT, "Device info does not allow EEPROM writes");
     }
     write_command = device_info.eeprom_write_sequence[0];
+  } else {
+    return Status(Code::UNIMPLEMENTED,
+                  strings::Cat("Write not implemented for section type ", section));
   }
 
   size_t bytes_written = 0;
@@ -212,6 +215,29 @@ Status Pic24Controller::SectionErase(Section, const DeviceInfo &) {
   return Status(UNIMPLEMENTED, "Erasing the device has not been implmeneted yet.");
 }
 
+Status Pic24Controller::RowErase(uint32_t address, const DeviceInfo &device_info) {
+  // The NVMCON value for erasing a row or page differs between devices.
+  if (device_info.row_erase_sequence.size() != 1) {
+    return Status(UNIMPLEMENTED, "Device DB does not specify a row_erase_sequence");
+  }
+  RETURN_IF_ERROR(ResetPc());
+  // MOV #<row erase command>, W10
+  RETURN_IF_ERROR(WriteCommand(0x20000A | (device_info.row_erase_sequence[0] << 4)));
+  // MOV W10, NVMCON
+  RETURN_IF_ERROR(WriteCommand(0x883B0A));
+  RETURN_IF_ERROR(LoadAddress(address / 2));
+  // TBLWTL W0, [W6]
+  RETURN_IF_ERROR(WriteCommand(0xBB0B00));
+  RETURN_IF_ERROR(WriteCommand(NOP));
+  RETURN_IF_ERROR(WriteCommand(NOP));
+
+  // BSET NVMCON, #WR
+  RETURN_IF_ERROR(WriteCommand(0xA8E761));
+  RETURN_IF_ERROR(WriteCommand(NOP));
+  RETURN_IF_ERROR(WriteCommand(NOP));
+  return WaitForWr0();
+}
+
 Status Pic24Controller::WriteCommand(uint32_t payload) {
   return driver_->WriteDatastring(sequence_generator_->GetWriteCommandSequence(payload));
 }
@@ -38,6 +38,7 @@ class Pic24Controller : public Controller {
                const DeviceInfo &device_info) override;
   Status ChipErase(const DeviceInfo &device_info) override;
   Status SectionErase(Section section, const DeviceInfo &device_info) override;
+  Status RowErase(uint32_t address, const DeviceInfo &device_info) override;
 
  private:
   Status WriteCommand(uint32_t payload);
@@ -1,5 +1,8 @@
 #include "picnew8bitcontroller.h"
 
+#include "strings.h"
+#include "util.h"
+
 Status PicNew8BitController::Open() {
   RETURN_IF_ERROR(driver_->Open());
   return WriteTimedSequence(PicNew8BitSequenceGenerator::INIT_SEQUENCE, nullptr);
@@ -62,7 +65,19 @@ Status PicNew8BitController::Write(Section section, uint32_t address, const Data
     }
     return Status::OK;
   }
+  return WriteBlocks(section, address, data, device_info, false);
+}
+
+Status PicNew8BitController::WriteVerified(Section section, uint32_t address,
+                                           const Datastring &data, const DeviceInfo &device_info) {
+  if (section != FLASH) {
+    return Status(UNIMPLEMENTED, "Verified writes are only implemented for flash");
+  }
+  return WriteBlocks(section, address, data, device_info, true);
+}
 
+Status PicNew8BitController::WriteBlocks(Section section, uint32_t address, const Datastring &data,
+                                         const DeviceInfo &device_info, bool verify) {
   uint32_t block_size = 2;
   if (section == FLASH) {
     block_size = device_info.write_block_size;
@@ -80,6 +95,10 @@ Status PicNew8BitController::Write(Section section, uint32_t address, const Data
   }
   RETURN_IF_ERROR(WriteCommand(PicNew8BitCommand::LOAD_PC, pc));
 
+  const TimedSequence write_sequence = sequence_generator_->GetTimedSequence(
+      section == FLASH ? PicNew8BitSequenceGenerator::WRITE_SEQUENCE
+                       : PicNew8BitSequenceGenerator::CONFIG_WRITE_SEQUENCE,
+      &device_info);
   for (size_t write_count = 0; write_count < data.size(); write_count += block_size) {
     PrintProgress(write_count, data.size());
     for (uint32_t step = 0; step < block_size; step += 2) {
@@ -90,11 +109,36 @@ Status PicNew8BitController::Write(Section section, uint32_t address, const Data
           step == block_size - 2 ? PicNew8BitCommand::LOAD_DATA : PicNew8BitCommand::LOAD_DATA_INC,
           datum));
     }
-    RETURN_IF_ERROR(WriteTimedSequence(section == FLASH
-                                           ? PicNew8BitSequenceGenerator::WRITE_SEQUENCE
-                                           : PicNew8BitSequenceGenerator::CONFIG_WRITE_SEQUENCE,
-                                       &device_info));
-    RETURN_IF_ERROR(WriteCommand(PicNew8BitCommand::INCREMENT_ADDRESS));
+    if (!verify) {
+      RETURN_IF_ERROR(driver_->WriteTimedSequence(write_sequence));
+      RETURN_IF_ERROR(WriteCommand(PicNew8BitCommand::INCREMENT_ADDRESS));
+      continue;
+    }
+    // The block is read back in the same stream as its programming sequence, which leaves the PC
+    // at the start of the next block.
+    RETURN_IF_ERROR(driver_->QueueTimedSequence(write_sequence));
+    RETURN_IF_ERROR(VerifyBlock(pc, data.substr(write_count, block_size)));
+    pc += device_type_ == PIC16NEW ? block_size / 2 : block_size;
+  }
+  return Status::OK;
+}
+
+Status PicNew8BitController::VerifyBlock(uint32_t pc, const Datastring &data) {
+  Datastring16 words;
+  Status status(SYNC_LOST, "FAKE STATUS");
+  for (int attempt = 0; attempt < 3 && status.code() == SYNC_LOST; ++attempt) {
+    RETURN_IF_ERROR(WriteCommand(PicNew8BitCommand::LOAD_PC, pc));
+    status = ReadWithCommand(PicNew8BitCommand::READ_DATA_INC, data.size() / 2, &words);
+  }
+  RETURN_IF_ERROR(status);
+  Datastring read_data;
+  for (uint16_t word : words) {
+    read_data.push_back(word & 0xff);
+    read_data.push_back(word >> 8);
+  }
+  if (read_data != data) {
+    return Status(VERIFICATION_ERROR,
+                  strings::Cat("Data read back at PC ", HexUint32(pc), " is not what was written"));
   }
   return Status::OK;
 }
@@ -107,6 +151,15 @@ Status PicNew8BitController::SectionErase(Section, const DeviceInfo &) {
   return Status(UNIMPLEMENTED, "Section erase not implemented");
 }
 
+Status PicNew8BitController::RowErase(uint32_t address, const DeviceInfo &device_info) {
+  uint32_t pc = address;
+  if (device_type_ == PIC16NEW) {
+    pc /= 2;
+  }
+  RETURN_IF_ERROR(WriteCommand(PicNew8BitCommand::LOAD_PC, pc));
+  return WriteTimedSequence(PicNew8BitSequenceGenerator::ROW_ERASE_SEQUENCE, &device_info);
+}
+
 Status PicNew8BitController::WriteCommand(PicNew8BitCommand command) {
   return driver_->WriteDatastring(sequence_generator_->GetCommandSequence(command));
 }
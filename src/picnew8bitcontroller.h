@@ -44,8 +44,12 @@ class PicNew8BitController : public Controller {
               const DeviceInfo &device_info, Datastring *result) override;
   Status Write(Section section, uint32_t address, const Datastring &data,
                const DeviceInfo &device_info) override;
+  // Only implemented for the flash.
+  Status WriteVerified(Section section, uint32_t address, const Datastring &data,
+                       const DeviceInfo &device_info) override;
   Status ChipErase(const DeviceInfo &device_info) override;
   Status SectionErase(Section section, const DeviceInfo &device_info) override;
+  Status RowErase(uint32_t address, const DeviceInfo &device_info) override;
 
  protected:
   Status WriteCommand(PicNew8BitCommand command);
@@ -55,6 +59,13 @@ class PicNew8BitController : public Controller {
                             const DeviceInfo *device_info);
 
  private:
+  // Implements Write and WriteVerified for the sections written in blocks of words. If verify is
+  // set, each block is read back directly after programming it.
+  Status WriteBlocks(Section section, uint32_t address, const Datastring &data,
+                     const DeviceInfo &device_info, bool verify);
+  // Reads the words starting at pc, and compares them to the data written.
+  Status VerifyBlock(uint32_t pc, const Datastring &data);
+
   std::unique_ptr<Driver> driver_;
   std::unique_ptr<PicNew8BitSequenceGenerator> sequence_generator_;
 
@@ -0,0 +1,80 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+// Fixed capacity FIFO of bytes. Data is never moved once appended, such that (contiguous) parts of
+// the buffer can be handed to asynchronous USB transfers directly.
+class RingBuffer {
+ public:
+  explicit RingBuffer(size_t capacity) : data_(new uint8_t[capacity]), capacity_(capacity) {}
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == capacity_; }
+
+  // Appends a single byte. The buffer must not be full.
+  void Append(uint8_t byte) {
+    *AppendSpace() = byte;
+    ++size_;
+  }
+
+  // Returns the largest contiguous block of free space after the end of the data. The number of
+  // bytes available is stored in length. Use Commit to add the data written to the block.
+  uint8_t *AppendSpace(size_t *length = nullptr) {
+    size_t end = Wrap(start_ + size_);
+    if (length) {
+      *length = (end < start_ || size_ == capacity_ ? start_ : capacity_) - end;
+    }
+    return data_.get() + end;
+  }
+  void Commit(size_t length) { size_ += length; }
+
+  // Returns the largest contiguous block of data starting offset bytes from the start of the data.
+  // The number of bytes in the block is stored in length.
+  const uint8_t *Peek(size_t offset, size_t *length) const {
+    size_t begin = Wrap(start_ + offset);
+    *length = std::min(size_ - offset, capacity_ - begin);
+    return data_.get() + begin;
+  }
+
+  // Removes length bytes from the start of the data.
+  void Consume(size_t length) {
+    start_ = Wrap(start_ + length);
+    size_ -= length;
+    if (size_ == 0) {
+      start_ = 0;
+    }
+  }
+
+  void Clear() {
+    start_ = 0;
+    size_ = 0;
+  }
+
+ private:
+  size_t Wrap(size_t idx) const { return idx >= capacity_ ? idx - capacity_ : idx; }
+
+  std::unique_ptr<uint8_t[]> data_;
+  size_t capacity_;
+  size_t start_ = 0;
+  size_t size_ = 0;
+};
+
+#endif
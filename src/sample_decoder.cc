@@ -0,0 +1,124 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "sample_decoder.h"
+
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Words are at most 16 bits, sampled at every other byte.
+constexpr size_t kPadding = 32;
+
+// Collects the even bits of value into the low 16 bits of the result.
+uint32_t CompactEvenBits(uint32_t value) {
+#ifdef __BMI2__
+  return _pext_u32(value, 0x55555555);
+#else
+  value &= 0x55555555;
+  value = (value | (value >> 1)) & 0x33333333;
+  value = (value | (value >> 2)) & 0x0f0f0f0f;
+  value = (value | (value >> 4)) & 0x00ff00ff;
+  value = (value | (value >> 8)) & 0x0000ffff;
+  return value;
+#endif
+}
+
+int MaskToBit(uint8_t mask) {
+  int bit = 0;
+  while (bit < 7 && !(mask & (1 << bit))) {
+    ++bit;
+  }
+  return bit;
+}
+
+uint16_t ReverseBits(uint16_t value) {
+  value = ((value >> 1) & 0x5555) | ((value & 0x5555) << 1);
+  value = ((value >> 2) & 0x3333) | ((value & 0x3333) << 2);
+  value = ((value >> 4) & 0x0f0f) | ((value & 0x0f0f) << 4);
+  return (value >> 8) | (value << 8);
+}
+
+}  // namespace
+
+SampleDecoder::SampleDecoder(size_t sequence_size, const std::vector<int> &bit_offsets,
+                             int bit_count, bool lsb_first, uint8_t pgd_in_mask, size_t skip,
+                             Datastring16 *result)
+    : sequence_size_(sequence_size),
+      bit_count_(bit_count),
+      lsb_first_(lsb_first),
+      skip_(skip) {
+  for (int bit_offset : bit_offsets) {
+    sample_offsets_.push_back(bit_offset * 2 + 1);
+  }
+  AddTarget(pgd_in_mask, result);
+}
+
+void SampleDecoder::AddTarget(uint8_t pgd_in_mask, Datastring16 *result) {
+  targets_.push_back({MaskToBit(pgd_in_mask), result});
+}
+
+uint8_t *SampleDecoder::GetWriteBuffer(size_t size) {
+  if (buffer_.size() < buffer_fill_ + size + kPadding) {
+    buffer_.resize(buffer_fill_ + size + kPadding);
+  }
+  return &buffer_[buffer_fill_];
+}
+
+void SampleDecoder::Commit(size_t size) {
+  buffer_fill_ += size;
+  size_t pos = std::min(skip_, buffer_fill_);
+  skip_ -= pos;
+  while (buffer_fill_ - pos >= sequence_size_) {
+    for (const Target &target : targets_) {
+      for (size_t offset : sample_offsets_) {
+        target.result->push_back(DecodeWord(&buffer_[pos + offset], target.pgd_in_bit));
+      }
+    }
+    pos += sequence_size_;
+  }
+  if (pos > 0) {
+    memmove(&buffer_[0], &buffer_[pos], buffer_fill_ - pos);
+    buffer_fill_ -= pos;
+  }
+}
+
+uint16_t SampleDecoder::DecodeWord(const uint8_t *samples, int pgd_in_bit) const {
+  uint32_t bits;
+#ifdef __SSE2__
+  // Move the PGD bit to the top of each byte, and collect the top bits of 32 samples.
+  const __m128i shift = _mm_cvtsi32_si128(7 - pgd_in_bit);
+  __m128i low = _mm_sll_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(samples)), shift);
+  __m128i high =
+      _mm_sll_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + 16)), shift);
+  bits = CompactEvenBits(static_cast<uint32_t>(_mm_movemask_epi8(low)) |
+                         (static_cast<uint32_t>(_mm_movemask_epi8(high)) << 16));
+#else
+  bits = 0;
+  for (int i = 0; i < bit_count_; ++i) {
+    bits |= ((samples[i * 2] >> pgd_in_bit) & 1) << i;
+  }
+#endif
+  bits &= (1 << bit_count_) - 1;
+  if (!lsb_first_) {
+    bits = ReverseBits(bits) >> (16 - bit_count_);
+  }
+  return bits;
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SAMPLE_DECODER_H_
+#define SAMPLE_DECODER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "util.h"
+
+// Decodes the words read by a repeated read sequence from the raw pin samples returned by a
+// bitbang device. Each bit of a word is sampled at the second byte of the two bytes used to clock
+// that bit. The raw samples are read directly into the buffer of the decoder, and all complete
+// repetitions of the sequence are decoded as soon as they are available.
+class SampleDecoder {
+ public:
+  // The first skip samples are discarded. This allows writes preceding the read sequence to be sent
+  // to the device in the same stream.
+  SampleDecoder(size_t sequence_size, const std::vector<int> &bit_offsets, int bit_count,
+                bool lsb_first, uint8_t pgd_in_mask, size_t skip, Datastring16 *result);
+
+  // Adds another target, connected to the pin pgd_in_mask, for which the words are decoded from the
+  // same samples and stored in result.
+  void AddTarget(uint8_t pgd_in_mask, Datastring16 *result);
+
+  // Returns a buffer with room for size raw samples.
+  uint8_t *GetWriteBuffer(size_t size);
+  // Decodes the size bytes written to the buffer returned by GetWriteBuffer.
+  void Commit(size_t size);
+
+ private:
+  struct Target {
+    int pgd_in_bit;
+    Datastring16 *result;
+  };
+
+  uint16_t DecodeWord(const uint8_t *samples, int pgd_in_bit) const;
+
+  const size_t sequence_size_;
+  // Offset of the first sample of each word within a repetition of the sequence.
+  std::vector<size_t> sample_offsets_;
+  const int bit_count_;
+  const bool lsb_first_;
+  size_t skip_;
+  std::vector<Target> targets_;
+
+  // Raw samples of the current, incomplete, repetition followed by the newly read samples. The
+  // buffer is padded such that DecodeWord can always load a full 32 bytes.
+  Datastring buffer_;
+  size_t buffer_fill_ = 0;
+};
+
+#endif
@@ -139,6 +139,13 @@ std::vector<TimedStep> Pic18SequenceGenerator::GetTimedSequence(
       result.push_back(TimedStep{{base}, MicroSeconds(200)});
       result.push_back(TimedStep{GenerateBitSequenceLsbUpDown(0, 16), ZeroDuration});
       break;
+    case ROW_ERASE_SEQUENCE:
+      // The erase starts on the fourth clock of the NOP command, and runs while PGC is held high.
+      result.push_back(TimedStep{{base | PGC, base, base | PGC, base, base | PGC, base, base | PGC},
+                                 device_info ? device_info->row_erase_timing : MilliSeconds(5)});
+      result.push_back(TimedStep{{base}, MicroSeconds(200)});
+      result.push_back(TimedStep{GenerateBitSequenceLsbUpDown(0, 16), ZeroDuration});
+      break;
     default:
       FATAL("Requested unimplemented sequence %d\n", type);
   }
@@ -276,6 +283,9 @@ std::vector<TimedStep> PicNew8BitSequenceGenerator::GetTimedSequence(
     case CONFIG_WRITE_SEQUENCE:
       return {TimedStep{GetCommandSequence(PicNew8BitCommand::BEGIN_PROGRAMMING_INT_TIMED),
                         device_info->config_write_timing}};
+    case ROW_ERASE_SEQUENCE:
+      return {TimedStep{GetCommandSequence(PicNew8BitCommand::ROW_ERASE),
+                        device_info->row_erase_timing}};
     default:
       FATAL("Requested unimplemented sequence %d\n", type);
   }
@@ -50,6 +50,7 @@ class Pic18SequenceGenerator : public PicSequenceGenerator {
     BULK_ERASE_SEQUENCE,
     WRITE_SEQUENCE,
     WRITE_CONFIG_SEQUENCE,
+    ROW_ERASE_SEQUENCE,
   };
 
   Datastring GetCommandSequence(Pic18Command command, uint16_t payload) const;
@@ -85,6 +86,7 @@ class PicNew8BitSequenceGenerator : public PicSequenceGenerator {
     CHIP_ERASE_SEQUENCE,
     WRITE_SEQUENCE,
     CONFIG_WRITE_SEQUENCE,
+    ROW_ERASE_SEQUENCE,
   };
 
   Datastring GetCommandSequence(PicNew8BitCommand command, uint32_t payload) const;
@@ -0,0 +1,270 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "device_family.h"
+#include "strings.h"
+
+#if defined(_WIN32)
+
+Status Server::Run(const std::string &) {
+  return Status(UNIMPLEMENTED, "Server mode is not supported on Windows");
+}
+
+#else
+
+namespace {
+
+// Maximum number of parsed programs kept by the server.
+constexpr size_t kMaxCachedPrograms = 16;
+
+// Computes the 64-bit FNV-1a hash of data.
+uint64_t Fnv1aHash(const std::string &data) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+Status ReadFile(const std::string &filename, std::string *contents) {
+  FILE *in = fopen(filename.c_str(), "rb");
+  if (!in) {
+    return Status(FILE_NOT_FOUND,
+                  strings::Cat("Could not open file '", filename, "': ", strerror(errno)));
+  }
+  char buffer[4096];
+  size_t bytes_read;
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    contents->append(buffer, bytes_read);
+  }
+  bool read_error = ferror(in);
+  fclose(in);
+  if (read_error) {
+    return Status(PARSE_ERROR, strings::Cat("Could not read file '", filename, "'"));
+  }
+  return Status::OK;
+}
+
+bool WriteAll(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+}  // namespace
+
+Status Server::Run(const std::string &path) {
+  sockaddr_un address;
+  if (path.size() >= sizeof(address.sun_path)) {
+    return Status(INVALID_ARGUMENT, strings::Cat("Socket path '", path, "' is too long"));
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return Status(INIT_FAILED, strings::Cat("Could not create socket: ", strerror(errno)));
+  }
+  AutoClosureRunner close_socket([listen_fd] { close(listen_fd); });
+  // Remove a socket left behind by a previous instance.
+  struct stat path_stat;
+  if (stat(path.c_str(), &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+    unlink(path.c_str());
+  }
+  // Only the user running the server may connect, as requests can reprogram any attached device.
+  mode_t old_umask = umask(0177);
+  int bind_result = bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+  umask(old_umask);
+  if (bind_result < 0 || listen(listen_fd, 4) < 0) {
+    return Status(INIT_FAILED,
+                  strings::Cat("Could not listen on socket '", path, "': ", strerror(errno)));
+  }
+  print_msg(1, "Listening on %s\n", path.c_str());
+
+  while (true) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return Status(INIT_FAILED, strings::Cat("Error accepting connection: ", strerror(errno)));
+    }
+    HandleConnection(fd);
+    close(fd);
+  }
+}
+
+void Server::HandleConnection(int fd) {
+  std::string buffer;
+  char data[1024];
+  while (true) {
+    ssize_t bytes_read = recv(fd, data, sizeof(data), 0);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes_read <= 0) {
+      return;
+    }
+    buffer.append(data, bytes_read);
+    size_t end;
+    while ((end = buffer.find('\n')) != std::string::npos) {
+      std::string request = buffer.substr(0, end);
+      buffer.erase(0, end + 1);
+      if (!request.empty() && request.back() == '\r') {
+        request.pop_back();
+      }
+      if (!WriteAll(fd, HandleRequest(request) + "\n")) {
+        return;
+      }
+    }
+  }
+}
+
+std::string Server::HandleRequest(const std::string &request) {
+  Job job;
+  std::string result;
+  Status status = ParseJob(request, &job);
+  if (status.ok()) {
+    status = PerformJob(job, &result);
+  }
+  if (!status.ok()) {
+    // Responses are single lines.
+    std::string message = status.message();
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    return strings::Cat("ERROR ", status.code(), " ", message);
+  }
+  return result.empty() ? "OK" : strings::Cat("OK ", result);
+}
+
+Status Server::PerformJob(const Job &job, std::string *result) {
+  // Validate the sections before doing anything, as ParseSections aborts on unknown names.
+  for (const std::string &section : strings::Split<std::string>(job.sections, ',', false)) {
+    if (section != "all" && section != "flash" && section != "user-id" && section != "config" &&
+        section != "eeprom") {
+      return Status(INVALID_ARGUMENT, strings::Cat("Unknown section name ", section));
+    }
+  }
+  std::shared_ptr<const Program> program = std::make_shared<Program>();
+  if (job.action == "write-program" || job.action == "verify") {
+    RETURN_IF_ERROR(GetProgram(job.input, &program));
+  }
+  HighLevelController *controller;
+  RETURN_IF_ERROR(GetController(job, &controller));
+  controller->SetDevice(job.device);
+
+  if (job.action == "erase") {
+    if (job.sections == "all") {
+      return controller->ChipErase();
+    } else {
+      return controller->SectionErase(ParseSections(job.sections));
+    }
+  } else if (job.action == "write-program") {
+    return controller->WriteProgram(ParseSections(job.sections), *program,
+                                    ParseEraseMode(job.erase_mode));
+  } else if (job.action == "verify") {
+    return controller->VerifyProgram(ParseSections(job.sections), *program);
+  } else if (job.action == "identify") {
+    RETURN_IF_ERROR(controller->ReadDeviceInfo());
+    *result = controller->device_info().name;
+    return Status::OK;
+  }
+  return Status(INVALID_ARGUMENT, strings::Cat("Unknown action '", job.action, "'"));
+}
+
+Status Server::GetDeviceDb(const Job &job, std::shared_ptr<const DeviceDb> *device_db) {
+  std::shared_ptr<const DeviceDb> &cached_db = device_dbs_[{job.family, job.device_db}];
+  if (!cached_db) {
+    std::unique_ptr<DeviceDb> loaded_db;
+    Status status = LoadDeviceDb(job.family, job.device_db, binary_path_, &loaded_db);
+    if (!status.ok()) {
+      device_dbs_.erase({job.family, job.device_db});
+      return status;
+    }
+    cached_db = std::move(loaded_db);
+  }
+  *device_db = cached_db;
+  return Status::OK;
+}
+
+Status Server::GetProgram(const std::string &filename, std::shared_ptr<const Program> *program) {
+  std::string contents;
+  RETURN_IF_ERROR(ReadFile(filename, &contents));
+  const uint64_t hash = Fnv1aHash(contents);
+  for (auto iter = programs_.begin(); iter != programs_.end(); ++iter) {
+    if (iter->hash == hash && iter->contents == contents) {
+      programs_.splice(programs_.begin(), programs_, iter);
+      *program = iter->program;
+      return Status::OK;
+    }
+  }
+
+  FILE *in = fmemopen(&contents[0], contents.size(), "rb");
+  if (!in) {
+    return Status(PARSE_ERROR, strings::Cat("Could not read file '", filename, "'"));
+  }
+  auto parsed_program = std::make_shared<Program>();
+  Status status = ReadIhex(parsed_program.get(), in);
+  fclose(in);
+  RETURN_IF_ERROR(status);
+  if (programs_.size() >= kMaxCachedPrograms) {
+    programs_.pop_back();
+  }
+  programs_.push_front(CachedProgram{hash, std::move(contents), parsed_program});
+  *program = std::move(parsed_program);
+  return Status::OK;
+}
+
+Status Server::GetController(const Job &job, HighLevelController **controller) {
+  std::shared_ptr<const DeviceDb> device_db;
+  RETURN_IF_ERROR(GetDeviceDb(job, &device_db));
+  if (!controller_ || controller_family_ != job.family || controller_device_db_ != device_db) {
+    // Close the programmer before opening it again for the new controller.
+    controller_.reset();
+    std::unique_ptr<Driver> driver = Driver::CreateFromFlags();
+    driver->set_keep_open(true);
+    std::unique_ptr<Controller> family_controller;
+    RETURN_IF_ERROR(CreateController(job.family, std::move(driver), &family_controller));
+    controller_ = std::make_unique<HighLevelController>(std::move(family_controller), device_db);
+    if (!shadow_directory_.empty()) {
+      controller_->SetShadow(shadow_directory_, shadow_key_address_, shadow_key_size_);
+    }
+    controller_family_ = job.family;
+    controller_device_db_ = device_db;
+  }
+  *controller = controller_.get();
+  return Status::OK;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/* Copyright (C) 2016 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "device_db.h"
+#include "high_level_controller.h"
+#include "job_queue.h"
+#include "program.h"
+#include "status.h"
+
+// Performs the jobs sent by clients over a Unix domain socket. Each request is a single line
+// containing a job description as accepted by ParseJob, and is answered by a single line starting
+// with either OK or ERROR. The programmer is kept open between requests, and the device DBs and
+// programs are cached.
+class Server {
+ public:
+  explicit Server(const std::string &binary_path) : binary_path_(binary_path) {}
+
+  // Sets the shadow configuration for the controllers (see HighLevelController::SetShadow). An
+  // empty directory disables the shadow.
+  void SetShadow(const std::string &directory, uint32_t key_address, uint32_t key_size) {
+    shadow_directory_ = directory;
+    shadow_key_address_ = key_address;
+    shadow_key_size_ = key_size;
+  }
+
+  // Listens on the socket at path, and handles the connections one at a time. Only returns on
+  // errors.
+  Status Run(const std::string &path);
+
+ private:
+  // Handles all requests on the connected socket fd, until the client closes the connection.
+  void HandleConnection(int fd);
+  // Returns the response line for request.
+  std::string HandleRequest(const std::string &request);
+  Status PerformJob(const Job &job, std::string *result);
+  Status GetDeviceDb(const Job &job, std::shared_ptr<const DeviceDb> *device_db);
+  // Returns the program in filename. Programs are cached by the file contents, such that modified
+  // files are picked up. Only the most recently used programs are kept.
+  Status GetProgram(const std::string &filename, std::shared_ptr<const Program> *program);
+  // Returns the controller for the device family and device DB of job, reusing the controller
+  // (and thereby the open programmer) of the previous request if possible.
+  Status GetController(const Job &job, HighLevelController **controller);
+
+  const std::string binary_path_;
+  std::string shadow_directory_;
+  uint32_t shadow_key_address_ = 0;
+  uint32_t shadow_key_size_ = 0;
+  std::map<std::pair<std::string, std::string>, std::shared_ptr<const DeviceDb>> device_dbs_;
+  struct CachedProgram {
+    uint64_t hash;
+    std::string contents;
+    std::shared_ptr<const Program> program;
+  };
+  // The cached programs, most recently used first.
+  std::list<CachedProgram> programs_;
+  std::unique_ptr<HighLevelController> controller_;
+  std::string controller_family_;
+  std::shared_ptr<const DeviceDb> controller_device_db_;
+};
+
+#endif
@@ -30,6 +30,7 @@ enum Code {
   PARSE_ERROR,
   VERIFICATION_ERROR,
   FILE_NOT_FOUND,
+  CANCELLED,
 };
 
 #ifdef __clang__
@@ -119,18 +119,57 @@ const char *SectionToName(Section section) {
 
 bool will_print(int level) { return level <= FLAGS_verbosity; }
 
+static thread_local std::function<void(const std::string &)> message_sink;
+
 void print_msg(int level, const char *fmt, ...) {
-  if (level <= FLAGS_verbosity) {
-    va_list args;
-    va_start(args, fmt);
+  if (level > FLAGS_verbosity) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  if (!message_sink) {
     vfprintf(stderr, fmt, args);
     va_end(args);
+    return;
+  }
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int length = vsnprintf(nullptr, 0, fmt, args_copy);
+  va_end(args_copy);
+  if (length > 0) {
+    std::string message(length + 1, 0);
+    vsnprintf(&message[0], message.size(), fmt, args);
+    message.resize(length);
+    message_sink(message);
+  }
+  va_end(args);
+}
+
+void SetMessageSink(std::function<void(const std::string &message)> sink) {
+  message_sink = std::move(sink);
+}
+
+static thread_local std::function<void(size_t, size_t)> progress_sink;
+
+void SetProgressSink(std::function<void(size_t done, size_t total)> sink) {
+  progress_sink = std::move(sink);
+}
+
+bool ReportProgressToSink(size_t done, size_t total) {
+  if (!progress_sink) {
+    return false;
   }
+  progress_sink(done, total);
+  return true;
 }
 
 void PrintProgress(size_t done, size_t total) {
-  static size_t last_done = 0;
-  static size_t last_total = 0;
+  if (ReportProgressToSink(done, total)) {
+    return;
+  }
+  // Thread local, such that multiple devices can be programmed in parallel.
+  static thread_local size_t last_done = 0;
+  static thread_local size_t last_total = 0;
 
   if (last_done < done || done == 0 || last_total != total) {
     last_done = 0;
@@ -181,3 +220,17 @@ std::vector<Section> ParseSections(const std::string &sections_str) {
   }
   return sections;
 }
+
+EraseMode ParseEraseMode(const std::string &erase_mode) {
+  if (erase_mode == "chip") {
+    return CHIP_ERASE;
+  } else if (erase_mode == "section") {
+    return SECTION_ERASE;
+  } else if (erase_mode == "row") {
+    return ROW_ERASE;
+  } else if (erase_mode == "none") {
+    return NO_ERASE;
+  } else {
+    fatal("No such erase mode '%s'\n", erase_mode.c_str());
+  }
+}
@@ -141,10 +141,20 @@ std::string HexUint32(uint32_t address);
 
 bool will_print(int level);
 void print_msg(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// Sets the function receiving the messages printed by print_msg on the calling thread. While set,
+// print_msg passes the formatted messages to sink instead of printing them. Pass nullptr to
+// restore printing.
+void SetMessageSink(std::function<void(const std::string &message)> sink);
 void PrintProgress(size_t done, size_t total);
+// Sets the function receiving the progress of the operations on the calling thread. While set,
+// PrintProgress reports to sink instead of printing. Pass nullptr to restore printing.
+void SetProgressSink(std::function<void(size_t done, size_t total)> sink);
+// Reports progress to the sink of the calling thread. Returns false if no sink is set.
+bool ReportProgressToSink(size_t done, size_t total);
 
 std::string Dirname(const std::string &str);
 
 std::vector<Section> ParseSections(const std::string &sections_str);
+EraseMode ParseEraseMode(const std::string &erase_mode);
 
 #endif